@@ -0,0 +1,127 @@
+#include "intro.h"
+
+#include "heap.h"
+#include "stats.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INSERTION_CUTOFF 16 // Ranges this short are left to insertion sort.
+#define NINTHER_CUTOFF   128 // Ranges this long take the median of three medians as pivot.
+
+// Insertion sort of A[lo .. hi), for the short ranges partitioning leaves behind.
+void intro_insertion(Stats *stats, uint32_t *A, uint32_t lo, uint32_t hi) {
+    for (uint32_t i = lo + 1; i < hi; i++) {
+        uint32_t j = i;
+        uint32_t temp = move(stats, A[i]);
+
+        while (j > lo && cmp(stats, temp, A[j - 1]) == -1) {
+            A[j] = move(stats, A[j - 1]);
+            j--;
+        }
+
+        A[j] = move(stats, temp);
+    }
+}
+
+// Returns the median of A[a], A[b] and A[c].
+uint32_t median_of_3(Stats *stats, uint32_t *A, uint32_t a, uint32_t b, uint32_t c) {
+    if (cmp(stats, A[a], A[b]) == -1) {
+        if (cmp(stats, A[b], A[c]) == -1) {
+            return A[b];
+        }
+        return cmp(stats, A[a], A[c]) == -1 ? A[c] : A[a];
+    }
+    if (cmp(stats, A[a], A[c]) == -1) {
+        return A[a];
+    }
+    return cmp(stats, A[b], A[c]) == -1 ? A[c] : A[b];
+}
+
+// Picks the pivot of A[lo .. hi): the median of the first, middle and last elements, or for long
+// ranges the median of the medians of three spread-out triples (Tukey's ninther), so sorted and
+// reverse-sorted input still split near the middle.
+uint32_t intro_pivot(Stats *stats, uint32_t *A, uint32_t lo, uint32_t hi) {
+    uint32_t n = hi - lo;
+    uint32_t mid = lo + n / 2;
+    if (n < NINTHER_CUTOFF) {
+        return median_of_3(stats, A, lo, mid, hi - 1);
+    }
+
+    uint32_t s = n / 8;
+    uint32_t m1 = median_of_3(stats, A, lo, lo + s, lo + 2 * s);
+    uint32_t m2 = median_of_3(stats, A, mid - s, mid, mid + s);
+    uint32_t m3 = median_of_3(stats, A, hi - 1 - 2 * s, hi - 1 - s, hi - 1);
+    if (cmp(stats, m1, m2) == -1) {
+        if (cmp(stats, m2, m3) == -1) {
+            return m2;
+        }
+        return cmp(stats, m1, m3) == -1 ? m3 : m1;
+    }
+    if (cmp(stats, m1, m3) == -1) {
+        return m1;
+    }
+    return cmp(stats, m2, m3) == -1 ? m3 : m2;
+}
+
+// Three-way partition of A[lo .. hi) around pivot: afterwards A[lo .. *lt) < pivot,
+// A[*lt .. *gt) == pivot and A[*gt .. hi) > pivot, so runs of duplicates are finished in one pass.
+void partition_3way(
+    Stats *stats, uint32_t *A, uint32_t lo, uint32_t hi, uint32_t pivot, uint32_t *lt, uint32_t *gt) {
+    uint32_t less = lo;
+    uint32_t i = lo;
+    uint32_t greater = hi;
+
+    while (i < greater) {
+        int c = cmp(stats, A[i], pivot);
+        if (c == -1) {
+            if (i != less) {
+                swap(stats, &A[less], &A[i]);
+            }
+            less++;
+            i++;
+        } else if (c == 1) {
+            greater--;
+            swap(stats, &A[i], &A[greater]);
+        } else {
+            i++;
+        }
+    }
+
+    *lt = less;
+    *gt = greater;
+}
+
+// Sorts A[lo .. hi). Recursion only goes into the smaller side of each partition and the loop
+// carries on with the larger one, so the stack stays O(log n) deep. Once depth partitions have not
+// finished a range, it is heap sorted instead, which bounds the time at O(n log n).
+void intro_sorter(Stats *stats, uint32_t *A, uint32_t lo, uint32_t hi, uint32_t depth) {
+    while (hi - lo > INSERTION_CUTOFF) {
+        if (depth == 0) {
+            heap_sort(stats, A + lo, hi - lo);
+            return;
+        }
+        depth--;
+
+        uint32_t lt, gt;
+        partition_3way(stats, A, lo, hi, intro_pivot(stats, A, lo, hi), &lt, &gt);
+        if (lt - lo < hi - gt) {
+            intro_sorter(stats, A, lo, lt, depth);
+            lo = gt;
+        } else {
+            intro_sorter(stats, A, gt, hi, depth);
+            hi = lt;
+        }
+    }
+    intro_insertion(stats, A, lo, hi);
+}
+
+void intro_sort(Stats *stats, uint32_t *A, uint32_t n) {
+    // Depth limit of 2 * floor(log2(n))
+    uint32_t depth = 0;
+    for (uint32_t m = n; m > 1; m >>= 1) {
+        depth += 2;
+    }
+    intro_sorter(stats, A, 0, n, depth);
+}
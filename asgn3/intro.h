@@ -0,0 +1,5 @@
+#pragma once
+
+#include "stats.h"
+
+void intro_sort(Stats *stats, uint32_t *A, uint32_t n);
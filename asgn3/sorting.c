@@ -1,6 +1,7 @@
 #include "batcher.h"
 #include "gaps.h"
 #include "heap.h"
+#include "intro.h"
 #include "quick.h"
 #include "set.h"
 #include "shell.h"
@@ -13,7 +14,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#define OPTIONS "asbhq r:n:p: H"
+#define OPTIONS "asbhqi r:n:p: H"
 
 int main(int argc, char **argv) {
     int opt = 0;
@@ -31,13 +32,14 @@ int main(int argc, char **argv) {
     bool b_option = false; //batcher	t
     bool h_option = false; //shell		t
     bool q_option = false; //quick		t
+    bool i_option = false; //intro		t
     bool r_option = false; // seed		t
     bool n_option = false; //size		t
     bool p_option = false; // elements	t
     bool H_option = false; //help		t
 
     // Use getopt to parse the command-line options
-    while ((opt = getopt(argc, argv, "asbhqr:n:p:H")) != -1) {
+    while ((opt = getopt(argc, argv, "asbhqir:n:p:H")) != -1) {
         switch (opt) {
         case 'a':
             // Run all tests
@@ -47,6 +49,7 @@ int main(int argc, char **argv) {
         case 'b': b_option = true; break;
         case 'h': h_option = true; break;
         case 'q': q_option = true; break;
+        case 'i': i_option = true; break;
         case 'r':
             r_option = true;
             seed = strtoul(optarg, &seed_pointer, 10);
@@ -65,7 +68,7 @@ int main(int argc, char **argv) {
             printf("SYNOPSIS\n");
             printf("   A collection of comparison-based sorting algorithms.\n");
             printf("\nUSAGE\n");
-            printf("   ./sorting_arm64 [-Hasbhqn:p:r:] [-n length] [-p elements] [-r seed]\n");
+            printf("   ./sorting_arm64 [-Hasbhqin:p:r:] [-n length] [-p elements] [-r seed]\n");
             printf("\nOPTIONS\n");
             printf("   -H              Display program help and usage.\n");
             printf("   -a              Enable all sorts.\n");
@@ -73,6 +76,7 @@ int main(int argc, char **argv) {
             printf("   -b              Enable Batcher Sort.\n");
             printf("   -h              Enable Heap Sort.\n");
             printf("   -q              Enable Quick Sort.\n");
+            printf("   -i              Enable Intro Sort.\n");
             printf("   -n length       Specify number of array elements (default: 100).\n");
             printf("   -p elements     Specify number of elements to print (default: 100).\n");
             printf("   -r seed         Specify random seed (default: 13371453).\n");
@@ -81,7 +85,7 @@ int main(int argc, char **argv) {
             printf("SYNOPSIS\n");
             printf("   A collection of comparison-based sorting algorithms.\n");
             printf("\nUSAGE\n");
-            printf("   ./sorting_arm64 [-Hasbhqn:p:r:] [-n length] [-p elements] [-r seed]\n");
+            printf("   ./sorting_arm64 [-Hasbhqin:p:r:] [-n length] [-p elements] [-r seed]\n");
             printf("\nOPTIONS\n");
             printf("   -H              Display program help and usage.\n");
             printf("   -a              Enable all sorts.\n");
@@ -89,6 +93,7 @@ int main(int argc, char **argv) {
             printf("   -b              Enable Batcher Sort.\n");
             printf("   -h              Enable Heap Sort.\n");
             printf("   -q              Enable Quick Sort.\n");
+            printf("   -i              Enable Intro Sort.\n");
             printf("   -n length       Specify number of array elements (default: 100).\n");
             printf("   -p elements     Specify number of elements to print (default: 100).\n");
             printf("   -r seed         Specify random seed (default: 13371453).\n");
@@ -102,6 +107,7 @@ int main(int argc, char **argv) {
         setter = set_insert(setter, 2);
         setter = set_insert(setter, 3);
         setter = set_insert(setter, 4);
+        setter = set_insert(setter, 9);
 
         // paste everything for all
         // later, use if statement set_member to print all, paste each one so -a arrays will use the same array
@@ -123,6 +129,10 @@ int main(int argc, char **argv) {
         setter = set_insert(setter, 4);
     }
 
+    if (i_option == true) {
+        setter = set_insert(setter, 9);
+    }
+
     if (r_option == true) {
         setter = set_insert(setter, 5);
     }
@@ -146,6 +156,7 @@ int main(int argc, char **argv) {
     uint32_t *batcher_array = (uint32_t *) calloc(array_size, sizeof(uint32_t));
     uint32_t *heap_array = (uint32_t *) calloc(array_size, sizeof(uint32_t));
     uint32_t *quick_array = (uint32_t *) calloc(array_size, sizeof(uint32_t));
+    uint32_t *intro_array = (uint32_t *) calloc(array_size, sizeof(uint32_t));
 
     for (uint32_t i = 0; i < array_size; i++) {
         int randomize = random() & 0x3FFFFFFF;
@@ -168,6 +179,10 @@ int main(int argc, char **argv) {
         quick_array[i] = all_array[i];
     }
 
+    for (uint32_t i = 0; i < array_size; i++) {
+        intro_array[i] = all_array[i];
+    }
+
     if (set_member(setter, 1) == 1) {
         if (element_amount > array_size) {
             element_amount = array_size;
@@ -264,6 +279,30 @@ int main(int argc, char **argv) {
         free(quick_array);
     }
 
+    if (set_member(setter, 9) == 1) {
+        if (element_amount > array_size) {
+            element_amount = array_size;
+        }
+
+        intro_sort(&stats, intro_array, array_size);
+        printf("Intro Sort, %d elements, %lu moves, %lu compares\n", array_size, stats.moves,
+            stats.compares);
+
+        for (uint32_t i = 0; i < element_amount; i++) {
+            if ((i != 0) && (i % 5 == 0)) {
+                printf("\n");
+            }
+            printf("%13" PRIu32 " ", intro_array[i]);
+        }
+
+        if (element_amount != 0) {
+            printf("\n");
+        }
+
+        reset(&stats);
+        free(intro_array);
+    }
+
     free(all_array);
     return 0;
 }
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+#include <gmp.h>
+
+#include "numtheory.h"
+#include "profile.h"
+#include "randstate.h"
+#include "ss.h"
+
+#define DEFAULT_ROUNDS  20
+#define DEFAULT_SEED    2023
+#define DEFAULT_THREADS 32
+#define DEFAULT_BITS    2048
+#define DEFAULT_BLOCKS  512
+#define DEFAULT_ITERS   50
+#define DEFAULT_KEYS    3
+#define DEFAULT_PAYLOAD (1 << 16)
+#define DEFAULT_BATCH   600
+#define BATCH_BITS      256
+
+// Print usage information.
+void print_help(void) {
+    printf("SYNOPSIS\n");
+    printf("   Benchmarks the SS number theory functions and prints CSV.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./bench [OPTIONS]");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -r rounds       Operations timed per key size (default: 20).\n");
+    printf("   -s seed         Random seed (default: 2023).\n");
+    printf("   -j threads      Maximum threads for the scaling runs (default: 32).\n");
+    printf("   -b bits         Key size for the scaling runs (default: 2048).\n");
+    printf("   -k blocks       Ciphertext blocks for the scaling runs (default: 512).\n");
+    printf("   -K keys         Keys generated per key size (default: 3).\n");
+    printf("   -m bytes        Bytes encrypted and decrypted per key (default: 65536).\n");
+    printf("   -B users        Keypairs in the batch keygen check (default: 600).\n");
+}
+
+// Returns the current monotonic time in seconds.
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Prints one CSV row: the value of metric for operation on bits-bit numbers with threads threads.
+// Every section prints rows of this one schema, under the header main prints once.
+void print_row(
+    const char *operation, uint64_t bits, int threads, const char *metric, double value) {
+    printf("%s,%" PRIu64 ",%d,%s,%.3f\n", operation, bits, threads, metric, value);
+}
+
+// Times pow_mod against mpz_powm for a random odd modulus of each size, with a full-size
+// exponent as in decryption. Exits if the two ever disagree.
+void bench_pow_mod(int rounds) {
+    static const uint64_t sizes[] = { 1024, 2048, 3072, 4096 };
+
+    mpz_t m, a, e, r1, r2;
+    mpz_inits(m, a, e, r1, r2, NULL);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        mpz_urandomb(m, state, sizes[s]);
+        mpz_setbit(m, sizes[s] - 1);
+        mpz_setbit(m, 0);
+        mpz_urandomm(e, state, m);
+
+        double pow_mod_time = 0, powm_time = 0;
+        for (int i = 0; i < rounds; i++) {
+            mpz_urandomm(a, state, m);
+
+            double start = now();
+            pow_mod(r1, a, e, m);
+            pow_mod_time += now() - start;
+
+            start = now();
+            mpz_powm(r2, a, e, m);
+            powm_time += now() - start;
+
+            if (mpz_cmp(r1, r2) != 0) {
+                fprintf(stderr, "Error: pow_mod disagrees with mpz_powm at %" PRIu64 " bits\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        print_row("pow_mod", sizes[s], 1, "pow_mod_us", 1e6 * pow_mod_time / rounds);
+        print_row("pow_mod", sizes[s], 1, "mpz_powm_us", 1e6 * powm_time / rounds);
+    }
+    mpz_clears(m, a, e, r1, r2, NULL);
+}
+
+// Times encrypting blocks with ss_encrypt against a precomputed SSEncCtx for a random odd modulus
+// of each size, which is also used as the public exponent as in SS.
+void bench_encrypt_ctx(int rounds) {
+    static const uint64_t sizes[] = { 1024, 2048, 3072, 4096 };
+
+    mpz_t n, m, c1, c2;
+    mpz_inits(n, m, c1, c2, NULL);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        mpz_urandomb(n, state, sizes[s]);
+        mpz_setbit(n, sizes[s] - 1);
+        mpz_setbit(n, 0);
+
+        SSEncCtx ctx;
+        ss_enc_init(&ctx, n);
+        double plain_time = 0, ctx_time = 0;
+        for (int i = 0; i < rounds; i++) {
+            mpz_urandomm(m, state, n);
+
+            double start = now();
+            ss_encrypt(c1, m, n);
+            plain_time += now() - start;
+
+            start = now();
+            ss_encrypt_ctx(c2, m, &ctx);
+            ctx_time += now() - start;
+
+            if (mpz_cmp(c1, c2) != 0) {
+                fprintf(stderr, "Error: ss_encrypt_ctx disagrees at %" PRIu64 " bits\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        ss_enc_clear(&ctx);
+        print_row("encrypt", sizes[s], 1, "ss_encrypt_us", 1e6 * plain_time / rounds);
+        print_row("encrypt", sizes[s], 1, "ss_encrypt_ctx_us", 1e6 * ctx_time / rounds);
+    }
+    mpz_clears(n, m, c1, c2, NULL);
+}
+
+// Times gcd and mod_inverse against the original Euclidean versions for random operands of each
+// size, and checks they agree.
+void bench_gcd(int rounds) {
+    static const uint64_t sizes[] = { 64, 256, 1024, 2048, 4096, 16384, 65536 };
+
+    mpz_t a, b, r1, r2;
+    mpz_inits(a, b, r1, r2, NULL);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double time[2][2] = { { 0, 0 }, { 0, 0 } };
+        for (int i = 0; i < rounds; i++) {
+            mpz_urandomb(a, state, sizes[s]);
+            mpz_urandomb(b, state, sizes[s]);
+            mpz_setbit(b, 0);
+
+            double start = now();
+            gcd_euclid(r1, a, b);
+            time[0][0] += now() - start;
+            start = now();
+            gcd(r2, a, b);
+            time[0][1] += now() - start;
+            if (mpz_cmp(r1, r2) != 0) {
+                fprintf(stderr, "Error: gcd disagrees at %" PRIu64 " bits\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+
+            start = now();
+            mod_inverse_euclid(r1, a, b);
+            time[1][0] += now() - start;
+            start = now();
+            mod_inverse(r2, a, b);
+            time[1][1] += now() - start;
+            if (mpz_cmp(r1, r2) != 0) {
+                fprintf(stderr, "Error: mod_inverse disagrees at %" PRIu64 " bits\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        print_row("gcd", sizes[s], 1, "euclid_us", 1e6 * time[0][0] / rounds);
+        print_row("gcd", sizes[s], 1, "gcd_us", 1e6 * time[0][1] / rounds);
+        print_row("mod_inverse", sizes[s], 1, "euclid_us", 1e6 * time[1][0] / rounds);
+        print_row("mod_inverse", sizes[s], 1, "mod_inverse_us", 1e6 * time[1][1] / rounds);
+    }
+    mpz_clears(a, b, r1, r2, NULL);
+}
+
+// Times ss_decrypt_file_threads on the same ciphertext for 1, 2, 4, ... up to max_threads threads
+// and checks every run recovers the plaintext.
+void bench_decrypt_threads(int max_threads, uint64_t bits, int blocks) {
+    mpz_t p, q, n, m, c;
+    mpz_inits(p, q, n, m, c, NULL);
+    SSPriv key;
+    ss_priv_init(&key);
+    ss_make_pub(p, q, n, bits, DEFAULT_ITERS);
+    ss_make_priv_key(&key, p, q);
+
+    // Random plaintext blocks, each prefixed with 0xFF and smaller than pq
+    size_t k = (mpz_sizeinbase(key.pq, 2) - 1) / 8;
+    size_t plain_size = 0;
+    char *plain = NULL;
+    FILE *plainfile = open_memstream(&plain, &plain_size);
+    FILE *cipher = tmpfile();
+    uint8_t *block = (uint8_t *) malloc(k);
+    for (int i = 0; i < blocks; i++) {
+        block[0] = 0xFF;
+        for (size_t j = 1; j < k; j++) {
+            block[j] = randstate_next() & 0xFF;
+        }
+        fwrite(block + 1, 1, k - 1, plainfile);
+        mpz_import(m, k, 1, 1, 1, 0, block);
+        ss_encrypt(c, m, n);
+        gmp_fprintf(cipher, "%Zx\n", c);
+    }
+    fclose(plainfile);
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        char *out = NULL;
+        size_t out_size = 0;
+        FILE *outfile = open_memstream(&out, &out_size);
+        rewind(cipher);
+
+        double start = now();
+        ss_decrypt_file_threads(cipher, outfile, &key, threads);
+        double elapsed = now() - start;
+        fclose(outfile);
+
+        if (out_size != plain_size || memcmp(out, plain, plain_size) != 0) {
+            fprintf(stderr, "Error: decryption with %d threads does not match\n", threads);
+            exit(EXIT_FAILURE);
+        }
+        free(out);
+
+        if (threads == 1) {
+            base = elapsed;
+        }
+        print_row("decrypt", bits, threads, "blocks", blocks);
+        print_row("decrypt", bits, threads, "seconds", elapsed);
+        print_row("decrypt", bits, threads, "blocks_per_second", blocks / elapsed);
+        print_row("decrypt", bits, threads, "speedup", base / elapsed);
+    }
+
+    fclose(cipher);
+    free(plain);
+    free(block);
+    ss_priv_clear(&key);
+    mpz_clears(p, q, n, m, c, NULL);
+}
+
+// Times confirming a random prime of each size with DEFAULT_ITERS Miller-Rabin rounds spread over
+// 1, 2, 4, ... up to max_threads threads. Exits if a prime is ever reported composite.
+void bench_confirm(int max_threads) {
+    static const uint64_t sizes[] = { 1024, 1536, 2048 };
+    mpz_t p;
+    mpz_init(p);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        make_prime(p, sizes[s] - 1, DEFAULT_ITERS);
+        double base = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            double start = now();
+            bool prime = is_prime_threads(p, DEFAULT_ITERS, threads);
+            double elapsed = now() - start;
+            if (!prime) {
+                fprintf(stderr, "Error: prime reported composite with %d threads\n", threads);
+                exit(EXIT_FAILURE);
+            }
+            if (threads == 1) {
+                base = elapsed;
+            }
+            print_row("confirm", sizes[s], threads, "rounds", DEFAULT_ITERS);
+            print_row("confirm", sizes[s], threads, "confirm_ms", 1e3 * elapsed);
+            print_row("confirm", sizes[s], threads, "speedup", base / elapsed);
+        }
+    }
+
+    mpz_clear(p);
+}
+
+// Times keygen, and encrypting and decrypting a payload of random bytes through the file
+// functions, for keys of 512 to 4096 bits. Exits if a payload does not decrypt to itself.
+void bench_keys(int keys, size_t payload) {
+    static const uint64_t sizes[] = { 512, 1024, 1536, 2048, 3072, 4096 };
+    mpz_t p, q, n;
+    mpz_inits(p, q, n, NULL);
+    SSPriv key;
+    ss_priv_init(&key);
+
+    char *plain = (char *) malloc(payload);
+    for (size_t i = 0; i < payload; i++) {
+        plain[i] = randstate_next() & 0xFF;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double keygen_time = 0, enc_time = 0, dec_time = 0;
+        for (int k = 0; k < keys; k++) {
+            double start = now();
+            ss_make_pub(p, q, n, sizes[s], DEFAULT_ITERS);
+            ss_make_priv_key(&key, p, q);
+            keygen_time += now() - start;
+
+            FILE *plainfile = fmemopen(plain, payload, "r");
+            FILE *cipher = tmpfile();
+            start = now();
+            ss_encrypt_file_threads(plainfile, cipher, n, 1, true);
+            enc_time += now() - start;
+            fclose(plainfile);
+
+            char *out = NULL;
+            size_t out_size = 0;
+            FILE *outfile = open_memstream(&out, &out_size);
+            rewind(cipher);
+            start = now();
+            ss_decrypt_file_threads(cipher, outfile, &key, 1);
+            dec_time += now() - start;
+            fclose(outfile);
+            fclose(cipher);
+
+            if (out_size != payload || memcmp(out, plain, payload) != 0) {
+                fprintf(stderr, "Error: payload does not decrypt at %" PRIu64 " bits\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+            free(out);
+        }
+        double megabytes = (double) payload * keys / 1e6;
+        print_row("keys", sizes[s], 1, "keys", keys);
+        print_row("keys", sizes[s], 1, "keygen_ms", 1e3 * keygen_time / keys);
+        print_row("keys", sizes[s], 1, "encrypt_mb_per_second", megabytes / enc_time);
+        print_row("keys", sizes[s], 1, "decrypt_mb_per_second", megabytes / dec_time);
+    }
+
+    free(plain);
+    ss_priv_clear(&key);
+    mpz_clears(p, q, n, NULL);
+}
+
+// Orders two primes for qsort.
+static int compare_primes(const void *a, const void *b) {
+    return mpz_cmp(*(const mpz_t *) a, *(const mpz_t *) b);
+}
+
+// Generates keypairs of BATCH_BITS bits for users users from their own streams, as keygen --batch
+// does, and times it. Exits if any prime turns up twice across the whole batch.
+void bench_batch(int users) {
+    RandStream *streams = (RandStream *) malloc(users * sizeof(RandStream));
+    mpz_t *primes = (mpz_t *) malloc(2 * users * sizeof(mpz_t));
+    mpz_t n;
+    mpz_init(n);
+
+    randstate_streams(streams, users);
+    double start = now();
+    for (int i = 0; i < users; i++) {
+        mpz_inits(primes[2 * i], primes[2 * i + 1], NULL);
+        ss_make_pub_stream(primes[2 * i], primes[2 * i + 1], n, BATCH_BITS, DEFAULT_ITERS,
+            &streams[i]);
+    }
+    double elapsed = now() - start;
+
+    qsort(primes, 2 * users, sizeof(mpz_t), compare_primes);
+    for (int i = 1; i < 2 * users; i++) {
+        if (mpz_cmp(primes[i - 1], primes[i]) == 0) {
+            fprintf(stderr, "Error: batch of %d keypairs repeats a prime\n", users);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    print_row("batch", BATCH_BITS, 1, "users", users);
+    print_row("batch", BATCH_BITS, 1, "keygen_ms", 1e3 * elapsed / users);
+    for (int i = 0; i < 2 * users; i++) {
+        mpz_clear(primes[i]);
+    }
+    mpz_clear(n);
+    free(primes);
+    free(streams);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int rounds = DEFAULT_ROUNDS;
+    unsigned long seed = DEFAULT_SEED;
+    int threads = DEFAULT_THREADS;
+    uint64_t bits = DEFAULT_BITS;
+    int blocks = DEFAULT_BLOCKS;
+    int keys = DEFAULT_KEYS;
+    long payload = DEFAULT_PAYLOAD;
+    int users = DEFAULT_BATCH;
+
+    while ((opt = getopt(argc, argv, "r:s:j:b:k:K:m:B:h")) != -1) {
+        switch (opt) {
+        case 'r': rounds = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 'j': threads = atoi(optarg); break;
+        case 'b': bits = strtoull(optarg, NULL, 0); break;
+        case 'k': blocks = atoi(optarg); break;
+        case 'K': keys = atoi(optarg); break;
+        case 'm': payload = atol(optarg); break;
+        case 'B': users = atoi(optarg); break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+    if (rounds <= 0 || threads <= 0 || blocks <= 0 || keys <= 0 || payload <= 0 || users <= 0
+        || bits < 64) {
+        fprintf(stderr, "Error: rounds, threads, blocks, keys, bytes and users must be positive, "
+                        "bits at least 64\n");
+        return 1;
+    }
+
+    randstate_init(seed);
+    printf("operation,bits,threads,metric,value\n");
+    bench_pow_mod(rounds);
+    bench_gcd(rounds);
+    bench_encrypt_ctx(rounds);
+    bench_decrypt_threads(threads, bits, blocks);
+    bench_confirm(threads);
+    bench_keys(keys, payload);
+    bench_batch(users);
+    profile_report(stderr);
+    randstate_clear();
+
+    return 0;
+}
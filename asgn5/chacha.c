@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chacha.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// One quarter round on word a, b, c and d of every lane.
+#define QUARTER(x, a, b, c, d)                                                                     \
+    for (int l = 0; l < CHACHA_LANES; l++) {                                                       \
+        x[a][l] += x[b][l];                                                                        \
+        x[d][l] = ROTL(x[d][l] ^ x[a][l], 16);                                                     \
+        x[c][l] += x[d][l];                                                                        \
+        x[b][l] = ROTL(x[b][l] ^ x[c][l], 12);                                                     \
+        x[a][l] += x[b][l];                                                                        \
+        x[d][l] = ROTL(x[d][l] ^ x[a][l], 8);                                                      \
+        x[c][l] += x[d][l];                                                                        \
+        x[b][l] = ROTL(x[b][l] ^ x[c][l], 7);                                                      \
+    }
+
+static uint32_t load32(const uint8_t *bytes) {
+    return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16
+           | (uint32_t) bytes[3] << 24;
+}
+
+static void store32(uint8_t *bytes, uint32_t word) {
+    bytes[0] = word & 0xFF;
+    bytes[1] = (word >> 8) & 0xFF;
+    bytes[2] = (word >> 16) & 0xFF;
+    bytes[3] = (word >> 24) & 0xFF;
+}
+
+void chacha_init(ChaCha *c, const uint8_t *key, const uint8_t *nonce) {
+    // "expand 32-byte k"
+    c->state[0] = 0x61707865;
+    c->state[1] = 0x3320646e;
+    c->state[2] = 0x79622d32;
+    c->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        c->state[4 + i] = load32(key + 4 * i);
+    }
+    c->state[12] = 0;
+    c->state[13] = 0;
+    c->state[14] = load32(nonce);
+    c->state[15] = load32(nonce + 4);
+    c->used = sizeof(c->stream);
+}
+
+// Fills c->stream with the next CHACHA_LANES blocks of keystream and advances the counter.
+static void chacha_blocks(ChaCha *c) {
+    uint32_t x[16][CHACHA_LANES];
+    uint32_t input[16][CHACHA_LANES];
+
+    // Lane l is block counter + l
+    uint64_t counter = (uint64_t) c->state[12] | (uint64_t) c->state[13] << 32;
+    for (int i = 0; i < 16; i++) {
+        for (int l = 0; l < CHACHA_LANES; l++) {
+            input[i][l] = c->state[i];
+        }
+    }
+    for (int l = 0; l < CHACHA_LANES; l++) {
+        input[12][l] = (uint32_t) (counter + l);
+        input[13][l] = (uint32_t) ((counter + l) >> 32);
+    }
+    memcpy(x, input, sizeof(x));
+
+    // 20 rounds: alternating column and diagonal rounds
+    for (int i = 0; i < 10; i++) {
+        QUARTER(x, 0, 4, 8, 12);
+        QUARTER(x, 1, 5, 9, 13);
+        QUARTER(x, 2, 6, 10, 14);
+        QUARTER(x, 3, 7, 11, 15);
+        QUARTER(x, 0, 5, 10, 15);
+        QUARTER(x, 1, 6, 11, 12);
+        QUARTER(x, 2, 7, 8, 13);
+        QUARTER(x, 3, 4, 9, 14);
+    }
+
+    // Serialize each lane little-endian as its own 64-byte block
+    for (int l = 0; l < CHACHA_LANES; l++) {
+        uint8_t *block = c->stream + l * CHACHA_BLOCK_SIZE;
+        for (int i = 0; i < 16; i++) {
+            uint32_t word = x[i][l] + input[i][l];
+            block[4 * i] = word & 0xFF;
+            block[4 * i + 1] = (word >> 8) & 0xFF;
+            block[4 * i + 2] = (word >> 16) & 0xFF;
+            block[4 * i + 3] = (word >> 24) & 0xFF;
+        }
+    }
+
+    counter += CHACHA_LANES;
+    c->state[12] = (uint32_t) counter;
+    c->state[13] = (uint32_t) (counter >> 32);
+    c->used = 0;
+}
+
+void chacha_xor(ChaCha *c, uint8_t *out, const uint8_t *in, size_t len) {
+    while (len > 0) {
+        if (c->used == sizeof(c->stream)) {
+            chacha_blocks(c);
+        }
+        size_t take = sizeof(c->stream) - c->used;
+        if (take > len) {
+            take = len;
+        }
+        for (size_t i = 0; i < take; i++) {
+            out[i] = in[i] ^ c->stream[c->used + i];
+        }
+        c->used += take;
+        out += take;
+        in += take;
+        len -= take;
+    }
+}
+
+void poly1305_init(Poly1305 *p, const uint8_t *key) {
+    // r is clamped as the algorithm requires: the top 4 bits of every 32-bit word and the bottom 2
+    // bits of the last three are cleared
+    p->r[0] = load32(key) & 0x3ffffff;
+    p->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    p->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    p->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    p->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++) {
+        p->h[i] = 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        p->pad[i] = load32(key + 16 + 4 * i);
+    }
+    p->buffered = 0;
+}
+
+// Adds the whole blocks of m[0 .. len) to the accumulator: h = (h + block) * r mod 2^130 - 5.
+// hibit is the bit set above each block, 2^128, except for a final partial block padded by hand.
+static void poly1305_blocks(Poly1305 *p, const uint8_t *m, size_t len, uint32_t hibit) {
+    const uint32_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+
+    while (len >= POLY1305_BLOCK_SIZE) {
+        h0 += load32(m) & 0x3ffffff;
+        h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(m + 12) >> 8) | hibit;
+
+        // Limbs above 2^130 wrap around multiplied by 5, which is what the s terms are for
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3
+                      + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4
+                      + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0
+                      + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1
+                      + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2
+                      + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        // Partial carry back down to 26-bit limbs
+        uint32_t c = (uint32_t) (d0 >> 26);
+        h0 = (uint32_t) d0 & 0x3ffffff;
+        d1 += c;
+        c = (uint32_t) (d1 >> 26);
+        h1 = (uint32_t) d1 & 0x3ffffff;
+        d2 += c;
+        c = (uint32_t) (d2 >> 26);
+        h2 = (uint32_t) d2 & 0x3ffffff;
+        d3 += c;
+        c = (uint32_t) (d3 >> 26);
+        h3 = (uint32_t) d3 & 0x3ffffff;
+        d4 += c;
+        c = (uint32_t) (d4 >> 26);
+        h4 = (uint32_t) d4 & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += POLY1305_BLOCK_SIZE;
+        len -= POLY1305_BLOCK_SIZE;
+    }
+
+    p->h[0] = h0;
+    p->h[1] = h1;
+    p->h[2] = h2;
+    p->h[3] = h3;
+    p->h[4] = h4;
+}
+
+void poly1305_update(Poly1305 *p, const uint8_t *data, size_t len) {
+    // Complete a block left over from the last call first
+    if (p->buffered > 0) {
+        size_t take = POLY1305_BLOCK_SIZE - p->buffered;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(p->buffer + p->buffered, data, take);
+        p->buffered += take;
+        data += take;
+        len -= take;
+        if (p->buffered < POLY1305_BLOCK_SIZE) {
+            return;
+        }
+        poly1305_blocks(p, p->buffer, POLY1305_BLOCK_SIZE, 1 << 24);
+        p->buffered = 0;
+    }
+
+    size_t whole = len - len % POLY1305_BLOCK_SIZE;
+    poly1305_blocks(p, data, whole, 1 << 24);
+    memcpy(p->buffer, data + whole, len - whole);
+    p->buffered = len - whole;
+}
+
+void poly1305_finish(Poly1305 *p, uint8_t *tag) {
+    // A final partial block is followed by a 1 byte and zeros instead of the bit above it
+    if (p->buffered > 0) {
+        p->buffer[p->buffered] = 1;
+        memset(p->buffer + p->buffered + 1, 0, POLY1305_BLOCK_SIZE - p->buffered - 1);
+        poly1305_blocks(p, p->buffer, POLY1305_BLOCK_SIZE, 0);
+    }
+
+    // Full carry, so every limb is below 2^26
+    uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+    uint32_t c = h1 >> 26;
+    h1 &= 0x3ffffff;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3ffffff;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3ffffff;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3ffffff;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h - (2^130 - 5), which is taken instead of h unless it is negative, without branching
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1 << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // tag = (h + pad) mod 2^128
+    uint32_t words[4]
+        = { h0 | h1 << 26, h1 >> 6 | h2 << 20, h2 >> 12 | h3 << 14, h3 >> 18 | h4 << 8 };
+    uint64_t sum = 0;
+    for (int i = 0; i < 4; i++) {
+        sum += (uint64_t) words[i] + p->pad[i];
+        store32(tag + 4 * i, (uint32_t) sum);
+        sum >>= 32;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHACHA_KEY_SIZE   32 // Bytes in a ChaCha20 key.
+#define CHACHA_NONCE_SIZE 8 // Bytes in a ChaCha20 nonce.
+#define CHACHA_BLOCK_SIZE 64 // Bytes of keystream per block.
+#define CHACHA_LANES      4 // Blocks computed side by side.
+
+#define POLY1305_KEY_SIZE   32 // Bytes in a Poly1305 one-time key.
+#define POLY1305_TAG_SIZE   16 // Bytes in a Poly1305 tag.
+#define POLY1305_BLOCK_SIZE 16 // Bytes of message per block.
+
+//
+// ChaCha20 stream cipher state, in the original variant with a 64-bit block counter and a 64-bit
+// nonce, so a single key and nonce can encrypt any file size.
+//
+typedef struct ChaCha {
+    uint32_t state[16]; // constants, key, counter and nonce
+    uint8_t stream[CHACHA_LANES * CHACHA_BLOCK_SIZE]; // keystream not yet used
+    size_t used; // bytes of stream already used
+} ChaCha;
+
+//
+// Initializes a ChaCha20 stream at block counter 0.
+//
+// Requires:
+//  key: CHACHA_KEY_SIZE bytes
+//  nonce: CHACHA_NONCE_SIZE bytes, never reused with the same key
+//
+void chacha_init(ChaCha *c, const uint8_t *key, const uint8_t *nonce);
+
+//
+// XORs len bytes of in with the next len bytes of keystream into out, so the same call both
+// encrypts and decrypts. in and out may be the same buffer.
+//
+// Keystream is generated CHACHA_LANES blocks at a time with the blocks in separate lanes of each
+// word array, so the rounds can be vectorized by the compiler when optimizing.
+//
+void chacha_xor(ChaCha *c, uint8_t *out, const uint8_t *in, size_t len);
+
+//
+// Poly1305 one-time authenticator state, with the accumulator and the clamped r in 26-bit limbs.
+// A key must authenticate only one message; ChaCha20 block 0 is the usual source of one.
+//
+typedef struct Poly1305 {
+    uint32_t r[5]; // clamped first half of the key
+    uint32_t h[5]; // accumulator
+    uint32_t pad[4]; // second half of the key, added at the end
+    uint8_t buffer[POLY1305_BLOCK_SIZE]; // message bytes not yet making up a whole block
+    size_t buffered;
+} Poly1305;
+
+//
+// Initializes a Poly1305 authenticator.
+//
+// Requires:
+//  key: POLY1305_KEY_SIZE bytes, used for this message only
+//
+void poly1305_init(Poly1305 *p, const uint8_t *key);
+
+//
+// Adds len bytes of data to the message. The message may be split over any number of calls.
+//
+void poly1305_update(Poly1305 *p, const uint8_t *data, size_t len);
+
+//
+// Finishes the message and stores its POLY1305_TAG_SIZE byte tag into tag.
+//
+void poly1305_finish(Poly1305 *p, uint8_t *tag);
@@ -1,17 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <locale.h>
 
+#include "keystore.h"
 #include "numtheory.h"
+#include "profile.h"
 #include "randstate.h"
 #include "ss.h"
 
+#define IO_BUFFER_SIZE (1 << 20)
+
 // Print usage information.
 void print_help(void) {
     printf("SYNOPSIS\n");
@@ -27,6 +34,29 @@ void print_help(void) {
     printf("   -i infile       Input file of data to decrypt (default: stdin).\n");
     printf("   -o outfile      Output file for decrypted data (default: stdout).\n");
     printf("   -n pvfile       Private key file (default: ss.priv).\n");
+    printf("   -k keystore     Keystore to take the private key of -u from, instead of -n.\n");
+    printf("   -u username     User whose private key in the keystore is used.\n");
+    printf("   -j threads      Number of threads to decrypt on (default: 1).\n");
+    printf("   -H              Require a file written by encrypt -H or for several\n");
+    printf("                   recipients; these are also recognized without -H.\n");
+    printf("   -r offset:len   Decrypt only len bytes from offset of a binary file (--range).\n");
+}
+
+static struct option long_options[] = {
+    { "range", required_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 },
+};
+
+// Parse an OFFSET:LEN byte range. Returns false if arg is not a valid range.
+static bool parse_range(const char *arg, uint64_t *offset, uint64_t *len) {
+    char *end = NULL;
+    *offset = strtoull(arg, &end, 10);
+    if (end == arg || *end != ':') {
+        return false;
+    }
+    const char *rest = end + 1;
+    *len = strtoull(rest, &end, 10);
+    return end != rest && *end == '\0';
 }
 
 int main(int argc, char *argv[]) {
@@ -35,9 +65,16 @@ int main(int argc, char *argv[]) {
     FILE *infile = stdin; // Default value
     FILE *outfile = stdout; // Default value
     char *pvfile = "ss.priv";
+    char *kspath = NULL;
+    char *username = NULL;
     bool verbose = false;
+    int threads = 1;
+    bool hybrid = false;
+    bool range = false;
+    uint64_t offset = 0;
+    uint64_t len = 0;
 
-    while ((opt = getopt(argc, argv, "hvi:o:n:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvi:o:n:k:u:j:Hr:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'i':
             infile = fopen(optarg, "r");
@@ -55,7 +92,24 @@ int main(int argc, char *argv[]) {
             }
             break;
         case 'n': pvfile = optarg; break;
+        case 'k': kspath = optarg; break;
+        case 'u': username = optarg; break;
         case 'v': verbose = true; break;
+        case 'H': hybrid = true; break;
+        case 'r':
+            if (!parse_range(optarg, &offset, &len)) {
+                fprintf(stderr, "Invalid range %s, expected OFFSET:LEN\n", optarg);
+                return 1;
+            }
+            range = true;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Number of threads must be positive\n");
+                return 1;
+            }
+            break;
         case 'h':
             print_help();
             fclose(infile);
@@ -69,52 +123,93 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Open private key file.
-    FILE *pvfp = fopen(pvfile, "r");
-    if (!pvfp) {
-        perror("Failed to open private key file");
-        fclose(infile);
-        fclose(outfile);
-        return 1;
-    }
+    // Read private key from the keystore, or from its file with its CRT components if it has them.
+    SSPriv key;
+    ss_priv_init(&key);
+    FILE *pvfp = NULL;
+    if (kspath != NULL) {
+        Keystore *ks = keystore_open(kspath);
+        uint32_t index = KEYSTORE_NOT_FOUND;
+        if (ks != NULL && username != NULL) {
+            index = keystore_find(ks, username);
+        }
+        bool found = index != KEYSTORE_NOT_FOUND && keystore_priv(ks, index, &key);
+        if (ks != NULL) {
+            keystore_close(ks);
+        }
+        if (!found) {
+            fprintf(stderr, "Failed to read the private key of -u from the keystore\n");
+            fclose(infile);
+            fclose(outfile);
+            ss_priv_clear(&key);
+            return 1;
+        }
+    } else {
+        // Open private key file.
+        pvfp = fopen(pvfile, "r");
+        if (!pvfp) {
+            perror("Failed to open private key file");
+            fclose(infile);
+            fclose(outfile);
+            return 1;
+        }
 
-    // Read private key from file.
-    mpz_t pq, d;
-    mpz_init(pq);
-    mpz_init(d);
-    ss_read_priv(pq, d, pvfp);
-    if (mpz_cmp_ui(pq, 0) == 0 || mpz_cmp_ui(d, 0) == 0) {
-        perror("Failed to read private key from file");
-        fclose(pvfp);
-        fclose(infile);
-        fclose(outfile);
-        mpz_clear(pq);
-        mpz_clear(d);
-        return 1;
+        if (!ss_read_priv_key(&key, pvfp) || mpz_cmp_ui(key.pq, 0) == 0
+            || mpz_cmp_ui(key.d, 0) == 0) {
+            fprintf(stderr, "Failed to read private key from file\n");
+            fclose(pvfp);
+            fclose(infile);
+            fclose(outfile);
+            ss_priv_clear(&key);
+            return 1;
+        }
     }
 
     // Print private key if verbose output is enabled.
     if (verbose) {
-        size_t pq_bits = mpz_sizeinbase(pq, 2);
+        size_t pq_bits = mpz_sizeinbase(key.pq, 2);
         gmp_printf("pq (%zu bits) = ", pq_bits);
-        mpz_out_str(stdout, 10, pq);
+        mpz_out_str(stdout, 10, key.pq);
         gmp_printf("\n");
 
-        size_t d_bits = mpz_sizeinbase(d, 2);
+        size_t d_bits = mpz_sizeinbase(key.d, 2);
         gmp_printf("d  (%zu bits) = ", d_bits);
-        mpz_out_str(stdout, 10, d);
+        mpz_out_str(stdout, 10, key.d);
         gmp_printf("\n");
     }
 
     // Decrypt the file.
-    ss_decrypt_file(infile, outfile, d, pq);
+    // Read and write in large chunks; records are small compared to a syscall
+    setvbuf(infile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    setvbuf(outfile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bytes = 0;
+    if (hybrid) {
+        bytes = ss_decrypt_file_hybrid(infile, outfile, &key);
+    } else if (range) {
+        bytes = ss_decrypt_file_range(infile, outfile, &key, threads, offset, len);
+    } else {
+        bytes = ss_decrypt_file_threads(infile, outfile, &key, threads);
+    }
+    fflush(outfile);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Report throughput on stderr, so it does not end up in the plaintext on stdout
+    if (verbose) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Decrypted %" PRIu64 " bytes in %.3f s (%.2f MB/s, %zu-bit pq)\n", bytes,
+            seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0, mpz_sizeinbase(key.pq, 2));
+        profile_report(stderr);
+    }
 
     // Close private key file and clear variables.
-    fclose(pvfp);
+    if (pvfp) {
+        fclose(pvfp);
+    }
     fclose(infile);
     fclose(outfile);
-    mpz_clear(pq);
-    mpz_clear(d);
+    ss_priv_clear(&key);
 
     return 0;
 }
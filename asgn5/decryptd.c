@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "keystore.h"
+#include "numtheory.h"
+#include "pool.h"
+#include "randstate.h"
+#include "ss.h"
+
+#define DEFAULT_SOCKET    "ss.sock"
+#define DEFAULT_PRIVKEY   "ss.priv"
+#define MAX_KEYS          64
+#define MAX_CONNECTIONS   256
+#define MAX_REQUEST       (1 << 20) // Largest ciphertext accepted in one request, in bytes.
+#define STATS_KEY         UINT32_MAX // Key index of a request for the latency counters.
+#define LATENCY_SUB       8 // Histogram buckets per power of two nanoseconds.
+#define LATENCY_BUCKETS   (64 * LATENCY_SUB)
+
+// Status of a response.
+enum { STATUS_OK = 0, STATUS_BAD_KEY = 1, STATUS_BAD_CIPHERTEXT = 2 };
+
+// A decryption request read from a client, waiting for its blocks to be decrypted.
+typedef struct Request {
+    size_t conn; // index of the connection to answer on, in fds and conns
+    uint32_t key; // index of the private key
+    uint32_t status;
+    SSHeader header;
+    size_t first; // index of the first block of this request in the batch
+    struct timespec start; // when the last byte of the request arrived
+} Request;
+
+// A client connection, the request it is sending, which may arrive over several wakeups, and the
+// response to its last request, which may leave over several wakeups.
+typedef struct Connection {
+    uint8_t frame[8]; // key and ciphertext length of the request
+    size_t have; // bytes of the frame and then the payload received so far
+    uint8_t *payload; // ciphertext, allocated once the frame has arrived
+    uint8_t *response; // frame and plaintext of the response, NULL if there is none
+    size_t response_len;
+    size_t sent; // bytes of the response sent so far
+    struct timespec start; // when the request being answered arrived
+} Connection;
+
+// Progress of the request or response on a connection.
+enum { RECEIVE_PARTIAL, RECEIVE_DONE, RECEIVE_CLOSED };
+enum { SEND_PARTIAL, SEND_DONE, SEND_CLOSED };
+
+// Every block of every request gathered in one round, decrypted together on the pool.
+typedef struct Batch {
+    size_t count; // blocks in this batch
+    size_t capacity; // blocks the arrays below have room for
+    mpz_t *in; // blocks to decrypt
+    mpz_t *out; // results, in the same order
+    uint32_t *key; // private key of each block
+    SSDecCtx *dec; // one context per thread and key, dec[id * keys + key]
+    size_t keys;
+} Batch;
+
+// Latency counters, in buckets of LATENCY_SUB per power of two nanoseconds.
+typedef struct Stats {
+    uint64_t requests;
+    uint64_t blocks;
+    uint64_t batches;
+    uint64_t latency[LATENCY_BUCKETS];
+} Stats;
+
+static volatile sig_atomic_t stop = 0;
+
+// Print usage information.
+void print_help(void) {
+    printf("SYNOPSIS\n");
+    printf("   Serves SS decryption requests over a Unix socket, keeping private keys loaded.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./decryptd [OPTIONS]");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Print the latency counters when stopped.\n");
+    printf("   -s socket       Path of the Unix socket to listen on (default: ss.sock).\n");
+    printf("   -n pvfile       Private key file, repeat for more keys (default: ss.priv).\n");
+    printf("   -k keystore     Keystore to take the keys given with -u from.\n");
+    printf("   -u username     Private key of username in the keystore, instead of -n. Can be\n");
+    printf("                   repeated and mixed with -n; keys are numbered in order.\n");
+    printf("   -j threads      Number of threads to decrypt on (default: 1).\n");
+}
+
+// Stops the main loop at the next wakeup.
+static void handle_stop(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+static void put_le32(uint8_t *bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t get_le32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+// Reads whatever has arrived of the request on the non-blocking socket fd, without reading past
+// its end. Returns RECEIVE_DONE once the frame and the whole payload are in conn, RECEIVE_PARTIAL
+// if more is still to come, and RECEIVE_CLOSED if the connection should be closed.
+static int receive_request(int fd, Connection *conn) {
+    while (true) {
+        uint8_t *dest;
+        size_t want;
+        if (conn->have < sizeof(conn->frame)) {
+            dest = conn->frame + conn->have;
+            want = sizeof(conn->frame) - conn->have;
+        } else {
+            uint32_t len = get_le32(conn->frame + 4);
+            if (len > MAX_REQUEST) {
+                return RECEIVE_CLOSED;
+            }
+            if (conn->payload == NULL) {
+                conn->payload = (uint8_t *) malloc(len == 0 ? 1 : len);
+                if (conn->payload == NULL) {
+                    return RECEIVE_CLOSED;
+                }
+            }
+            size_t got = conn->have - sizeof(conn->frame);
+            if (got == len) {
+                return RECEIVE_DONE;
+            }
+            dest = conn->payload + got;
+            want = len - got;
+        }
+
+        ssize_t got = read(fd, dest, want);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return RECEIVE_PARTIAL;
+        }
+        if (got <= 0) {
+            return RECEIVE_CLOSED;
+        }
+        conn->have += got;
+    }
+}
+
+// Frees the request a connection was receiving and gets it ready for the next one.
+static void connection_reset(Connection *conn) {
+    free(conn->payload);
+    conn->payload = NULL;
+    conn->have = 0;
+}
+
+// Writes as much of the response queued on conn as the non-blocking socket fd takes. Returns
+// SEND_DONE once all of it has gone out and frees it, SEND_PARTIAL if the client has no room for
+// the rest yet, and SEND_CLOSED if the connection should be closed.
+static int send_response(int fd, Connection *conn) {
+    while (conn->sent < conn->response_len) {
+        ssize_t put = write(fd, conn->response + conn->sent, conn->response_len - conn->sent);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return SEND_PARTIAL;
+        }
+        if (put <= 0) {
+            return SEND_CLOSED;
+        }
+        conn->sent += put;
+    }
+    free(conn->response);
+    conn->response = NULL;
+    return SEND_DONE;
+}
+
+// Frees everything a connection holds, once it is closed.
+static void connection_free(Connection *conn) {
+    connection_reset(conn);
+    free(conn->response);
+    conn->response = NULL;
+}
+
+// Bucket of a latency of ns nanoseconds: exact below LATENCY_SUB, then LATENCY_SUB buckets per
+// power of two, so every bucket is within 1 / LATENCY_SUB of its values.
+static int latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB) {
+        return ns;
+    }
+    int log = 63 - __builtin_clzll(ns);
+    return (log - 2) * LATENCY_SUB + ((ns >> (log - 3)) & (LATENCY_SUB - 1));
+}
+
+// Largest latency in nanoseconds that falls in bucket.
+static uint64_t latency_bound(int bucket) {
+    if (bucket < LATENCY_SUB) {
+        return bucket;
+    }
+    int log = bucket / LATENCY_SUB + 2;
+    uint64_t sub = bucket % LATENCY_SUB;
+    return ((LATENCY_SUB + sub + 1) << (log - 3)) - 1;
+}
+
+// Latency in microseconds below which fraction of the requests completed.
+static double latency_percentile(const Stats *stats, double fraction) {
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        total += stats->latency[i];
+    }
+    uint64_t rank = (uint64_t) (fraction * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen > rank) {
+            return latency_bound(i) / 1e3;
+        }
+    }
+    return 0.0;
+}
+
+// Formats the counters as one "name value" line each. Returns the length written to text.
+static int format_stats(const Stats *stats, char *text, size_t size) {
+    return snprintf(text, size,
+        "requests %" PRIu64 "\nblocks %" PRIu64 "\nbatches %" PRIu64 "\np50_us %.1f\np99_us %.1f\n",
+        stats->requests, stats->blocks, stats->batches, latency_percentile(stats, 0.50),
+        latency_percentile(stats, 0.99));
+}
+
+// Makes room for count more blocks in batch, growing its arrays by doubling.
+static void batch_reserve(Batch *batch, size_t count) {
+    if (batch->count + count <= batch->capacity) {
+        return;
+    }
+    size_t capacity = batch->capacity == 0 ? 64 : batch->capacity;
+    while (capacity < batch->count + count) {
+        capacity *= 2;
+    }
+    batch->in = (mpz_t *) realloc(batch->in, capacity * sizeof(mpz_t));
+    batch->out = (mpz_t *) realloc(batch->out, capacity * sizeof(mpz_t));
+    batch->key = (uint32_t *) realloc(batch->key, capacity * sizeof(uint32_t));
+    if (batch->in == NULL || batch->out == NULL || batch->key == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = batch->capacity; i < capacity; i++) {
+        mpz_inits(batch->in[i], batch->out[i], NULL);
+    }
+    batch->capacity = capacity;
+}
+
+// Decrypts every threads-th block of a batch, starting at block id.
+static void decrypt_task(void *arg, int id, int threads) {
+    Batch *batch = (Batch *) arg;
+    for (size_t i = id; i < batch->count; i += threads) {
+        SSDecCtx *ctx = &batch->dec[id * batch->keys + batch->key[i]];
+        ss_decrypt_ctx(batch->out[i], batch->in[i], ctx);
+    }
+}
+
+// Adds the blocks of the request that has fully arrived on conn to batch. Requests that cannot be
+// decrypted are kept with a bad status, to be answered like the rest.
+static void add_request(size_t index, const Connection *conn, Request *request, Batch *batch,
+    const SSPriv *keys, size_t nkeys) {
+    request->conn = index;
+    request->key = get_le32(conn->frame);
+    request->status = STATUS_OK;
+    request->first = batch->count;
+    request->header.blocks = 0;
+    uint32_t len = get_le32(conn->frame + 4);
+    const uint8_t *payload = conn->payload;
+
+    SSHeader *header = &request->header;
+    if (request->key == STATS_KEY) {
+        header->blocks = 0;
+    } else if (request->key >= nkeys) {
+        request->status = STATUS_BAD_KEY;
+    } else if (len < SS_HEADER_SIZE || !ss_parse_header(payload, header)
+               || 8 * ((uint64_t) header->block_bytes + 1)
+                      > mpz_sizeinbase(keys[request->key].pq, 2) - 1
+               || (len - SS_HEADER_SIZE) % header->width != 0) {
+        request->status = STATUS_BAD_CIPHERTEXT;
+        header->blocks = 0;
+    } else {
+        // The payload, not the header, says how many blocks there are
+        header->blocks = (len - SS_HEADER_SIZE) / header->width;
+        batch_reserve(batch, header->blocks);
+        for (uint64_t i = 0; i < header->blocks; i++) {
+            const uint8_t *record = payload + SS_HEADER_SIZE + i * header->width;
+            mpz_import(batch->in[batch->count], header->width, 1, 1, 1, 0, record);
+            batch->key[batch->count++] = request->key;
+        }
+    }
+}
+
+// Queues the plaintext of a request, whose blocks have been decrypted, or its status on the
+// connection the request came from.
+static void answer_request(Connection *conn, const Request *request, const Batch *batch,
+    const SSPriv *keys, const Stats *stats) {
+    uint32_t status = request->status;
+    size_t len = 0;
+    size_t capacity = request->key == STATS_KEY ? 256
+                      : request->status == STATUS_OK
+                          ? request->header.blocks * request->header.block_bytes
+                          : 0;
+
+    // The response is the frame followed by the body, sent in one piece
+    uint8_t *response = (uint8_t *) malloc(8 + capacity + 1);
+    if (response == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t *body = response + 8;
+    if (request->key == STATS_KEY) {
+        len = format_stats(stats, (char *) body, capacity);
+        len = len < capacity ? len : capacity - 1;
+    } else if (request->status == STATUS_OK) {
+        // Every decrypted block is less than pq, so it fits in as many bytes as pq
+        uint8_t *block = (uint8_t *) malloc((mpz_sizeinbase(keys[request->key].pq, 2) + 7) / 8);
+        if (block == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (uint64_t i = 0; i < request->header.blocks; i++) {
+            // Like decrypt, write every byte of a block but the 0xFF it starts with. Blocks that
+            // do not start with it were not encrypted for this key.
+            size_t block_size = 0;
+            mpz_export(block, &block_size, 1, 1, 0, 0, batch->out[request->first + i]);
+            if (block_size < 2 || block[0] != 0xFF
+                || block_size - 1 > request->header.block_bytes) {
+                status = STATUS_BAD_CIPHERTEXT;
+                len = 0;
+                break;
+            }
+            memcpy(body + len, block + 1, block_size - 1);
+            len += block_size - 1;
+        }
+        free(block);
+    }
+
+    put_le32(response, status);
+    put_le32(response + 4, len);
+    conn->response = response;
+    conn->response_len = 8 + len;
+    conn->sent = 0;
+    conn->start = request->start;
+}
+
+// Counts a request answered in full, timed from when it arrived.
+static void record_latency(Stats *stats, const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t ns
+        = (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec - start->tv_nsec;
+    stats->latency[latency_bucket(ns)]++;
+    stats->requests++;
+}
+
+// Opens a Unix socket listening at path, replacing a stale socket file.
+static int listen_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("Failed to create socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("Failed to listen on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    const char *socket_path = DEFAULT_SOCKET;
+    const char *pvfiles[MAX_KEYS];
+    bool by_name[MAX_KEYS] = { false }; // pvfiles[k] is a username in the keystore
+    size_t nkeys = 0;
+    const char *kspath = NULL;
+    bool verbose = false;
+    int threads = 1;
+
+    while ((opt = getopt(argc, argv, "hvs:n:k:u:j:")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'n':
+        case 'u':
+            if (nkeys == MAX_KEYS) {
+                fprintf(stderr, "At most %d private keys can be loaded\n", MAX_KEYS);
+                return 1;
+            }
+            by_name[nkeys] = opt == 'u';
+            pvfiles[nkeys++] = optarg;
+            break;
+        case 'k': kspath = optarg; break;
+        case 'v': verbose = true; break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Number of threads must be positive\n");
+                return 1;
+            }
+            break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+    if (nkeys == 0) {
+        pvfiles[nkeys++] = DEFAULT_PRIVKEY;
+    }
+
+    // Load and precompute every key once, with one decryption context per thread and key
+    SSPriv *keys = (SSPriv *) malloc(nkeys * sizeof(SSPriv));
+    Batch batch = { 0, 0, NULL, NULL, NULL, NULL, nkeys };
+    batch.dec = (SSDecCtx *) malloc(threads * nkeys * sizeof(SSDecCtx));
+    if (keys == NULL || batch.dec == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for keys.\n");
+        return 1;
+    }
+    Keystore *ks = kspath != NULL ? keystore_open(kspath) : NULL;
+    if (kspath != NULL && ks == NULL) {
+        return 1;
+    }
+    for (size_t k = 0; k < nkeys; k++) {
+        ss_priv_init(&keys[k]);
+        if (by_name[k]) {
+            uint32_t index = ks != NULL ? keystore_find(ks, pvfiles[k]) : KEYSTORE_NOT_FOUND;
+            if (index == KEYSTORE_NOT_FOUND || !keystore_priv(ks, index, &keys[k])) {
+                fprintf(stderr, "No private key for %s in the keystore\n", pvfiles[k]);
+                return 1;
+            }
+            continue;
+        }
+        FILE *pvfp = fopen(pvfiles[k], "r");
+        if (!pvfp) {
+            perror("Failed to open private key file");
+            return 1;
+        }
+        if (!ss_read_priv_key(&keys[k], pvfp) || mpz_cmp_ui(keys[k].pq, 0) == 0
+            || mpz_cmp_ui(keys[k].d, 0) == 0) {
+            fprintf(stderr, "Failed to read private key from %s\n", pvfiles[k]);
+            fclose(pvfp);
+            return 1;
+        }
+        fclose(pvfp);
+    }
+    if (ks != NULL) {
+        keystore_close(ks);
+    }
+    for (int t = 0; t < threads; t++) {
+        for (size_t k = 0; k < nkeys; k++) {
+            ss_dec_init(&batch.dec[t * nkeys + k], &keys[k]);
+        }
+    }
+
+    int listener = listen_socket(socket_path);
+    if (listener == -1) {
+        return 1;
+    }
+
+    // Stop cleanly on SIGINT and SIGTERM, and let writes to departed clients fail instead
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Pool *pool = pool_create(threads);
+    struct pollfd fds[1 + MAX_CONNECTIONS];
+    Connection conns[1 + MAX_CONNECTIONS]; // conns[i] belongs to fds[i]
+    size_t nfds = 1;
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    Request requests[MAX_CONNECTIONS];
+    Stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    while (!stop) {
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // Send what fits of every pending response, take in what has arrived on every other
+        // connection, and batch one request from each one whose request is complete, so requests
+        // arriving together are decrypted together. A client that stops halfway through a request,
+        // or does not read its response, only holds up itself: a connection with a response
+        // pending waits for POLLOUT and reads nothing more until the response is out.
+        size_t count = 0;
+        batch.count = 0;
+        for (size_t i = 1; i < nfds; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            bool closed = false;
+            if (conns[i].response != NULL) {
+                int progress = send_response(fds[i].fd, &conns[i]);
+                if (progress == SEND_DONE) {
+                    record_latency(&stats, &conns[i].start);
+                    fds[i].events = POLLIN;
+                }
+                closed = progress == SEND_CLOSED;
+            } else {
+                int progress = (fds[i].revents & POLLIN) ? receive_request(fds[i].fd, &conns[i])
+                                                         : RECEIVE_CLOSED;
+                if (progress == RECEIVE_DONE) {
+                    Request *request = &requests[count++];
+                    clock_gettime(CLOCK_MONOTONIC, &request->start);
+                    add_request(i, &conns[i], request, &batch, keys, nkeys);
+                    connection_reset(&conns[i]);
+                }
+                closed = progress == RECEIVE_CLOSED;
+            }
+            if (closed) {
+                // Closed or broken connection; the last one takes its place. Requests batched
+                // this round all come from connections before i, so their indexes still hold.
+                close(fds[i].fd);
+                connection_free(&conns[i]);
+                conns[i] = conns[nfds - 1];
+                fds[i--] = fds[--nfds];
+            }
+        }
+
+        if (batch.count > 0) {
+            pool_run(pool, decrypt_task, &batch);
+            stats.batches++;
+            stats.blocks += batch.count;
+        }
+        for (size_t r = 0; r < count; r++) {
+            // Most responses go out at once; the rest wait for the client to make room
+            size_t i = requests[r].conn;
+            answer_request(&conns[i], &requests[r], &batch, keys, &stats);
+            int progress = send_response(fds[i].fd, &conns[i]);
+            if (progress == SEND_DONE) {
+                record_latency(&stats, &requests[r].start);
+            } else if (progress == SEND_PARTIAL) {
+                fds[i].events = POLLOUT;
+            } else {
+                // The client is gone; its connection is closed when poll reports the hangup
+                shutdown(fds[i].fd, SHUT_RDWR);
+            }
+        }
+
+        // Accept new connections last, so their first requests wait for the next round
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd != -1 && nfds == 1 + MAX_CONNECTIONS) {
+                close(fd);
+            } else if (fd != -1 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+                close(fd);
+            } else if (fd != -1) {
+                conns[nfds].have = 0;
+                conns[nfds].payload = NULL;
+                conns[nfds].response = NULL;
+                fds[nfds].fd = fd;
+                fds[nfds].events = POLLIN;
+                fds[nfds++].revents = 0;
+            }
+        }
+    }
+
+    if (verbose) {
+        char text[256];
+        format_stats(&stats, text, sizeof(text));
+        fputs(text, stderr);
+    }
+
+    // Close every connection and free memory
+    for (size_t i = 0; i < nfds; i++) {
+        close(fds[i].fd);
+        if (i > 0) {
+            connection_free(&conns[i]);
+        }
+    }
+    unlink(socket_path);
+    pool_delete(pool);
+    for (size_t i = 0; i < threads * nkeys; i++) {
+        ss_dec_clear(&batch.dec[i]);
+    }
+    for (size_t i = 0; i < batch.capacity; i++) {
+        mpz_clears(batch.in[i], batch.out[i], NULL);
+    }
+    for (size_t k = 0; k < nkeys; k++) {
+        ss_priv_clear(&keys[k]);
+    }
+    free(batch.in);
+    free(batch.out);
+    free(batch.key);
+    free(batch.dec);
+    free(keys);
+
+    return 0;
+}
@@ -1,16 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
+#include "keystore.h"
 #include "numtheory.h"
+#include "profile.h"
 #include "randstate.h"
 #include "ss.h"
 
+#define IO_BUFFER_SIZE (1 << 20)
+#define MAX_RECIPIENTS 64
+
 // Print usage information.
 void print_help(void) {
     printf("SYNOPSIS\n");
@@ -25,17 +32,56 @@ void print_help(void) {
     printf("   -v              Display verbose program output.\n");
     printf("   -i infile       Input file of data to encrypt (default: stdin).\n");
     printf("   -o outfile      Output file for encrypted data (default: stdout).\n");
-    printf("   -n pbfile       Public key file (default: ss.pub).\n");
+    printf("   -n pbfile       Public key file (default: ss.pub). Repeat it to encrypt the\n");
+    printf("                   data once for every key given, in hybrid mode.\n");
+    printf("   -k keystore     Keystore to look up the keys given with -u in.\n");
+    printf("   -u username     Public key of username in the keystore, instead of -n. Can be\n");
+    printf("                   repeated and mixed with -n.\n");
+    printf("   -j threads      Number of threads to encrypt on (default: 1).\n");
+    printf("   -x              Write hexstring lines instead of the binary format.\n");
+    printf("   -H              Hybrid mode: encrypt a session key with SS and the data with\n");
+    printf("                   ChaCha20 (needs a key of at least 529 bits).\n");
+}
+
+// Reads the public key n and its username from the file at path. Returns false and prints an
+// error if the file cannot be read.
+static bool read_pub(const char *path, mpz_t n, char *username, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error: could not open public key file %s\n", path);
+        return false;
+    }
+
+    // Keys of 2048 bits and up do not fit a fixed-size line buffer
+    char *hex_key = NULL;
+    size_t hex_key_size = 0;
+    bool valid = getline(&hex_key, &hex_key_size, f) != -1 && mpz_set_str(n, hex_key, 16) != -1
+                 && fgets(username, size, f) != NULL;
+    free(hex_key);
+    fclose(f);
+    if (!valid) {
+        printf("Error: invalid public key file format\n");
+        return false;
+    }
+    username[strcspn(username, "\n")] = 0;
+    return true;
 }
 
 int main(int argc, char *argv[]) {
     int opt;
     FILE *infile = stdin;
     FILE *outfile = stdout;
-    char *pbfile = "ss.pub";
+    char *pbfiles[MAX_RECIPIENTS] = { "ss.pub" };
+    bool by_name[MAX_RECIPIENTS] = { false }; // pbfiles[i] is a username in the keystore
+    uint32_t recipients = 0;
+    char *kspath = NULL;
     bool verbose = false;
+    int threads = 1;
+    bool hex = false;
+    bool hybrid = false;
+    bool block_options = false; // -j or -x, which only apply to block encryption
 
-    while ((opt = getopt(argc, argv, "hv i: o: n:")) != -1) {
+    while ((opt = getopt(argc, argv, "hv i: o: n: k: u: j: x H")) != -1) {
         switch (opt) {
         case 'i':
             infile = fopen(optarg, "r");
@@ -51,54 +97,115 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             break;
-        case 'n': pbfile = optarg; break;
+        case 'n':
+        case 'u':
+            if (recipients == MAX_RECIPIENTS) {
+                printf("Error: at most %d public keys can be given\n", MAX_RECIPIENTS);
+                return 1;
+            }
+            by_name[recipients] = opt == 'u';
+            pbfiles[recipients++] = optarg;
+            break;
+        case 'k': kspath = optarg; break;
         case 'v': verbose = true; break;
+        case 'x':
+            hex = true;
+            block_options = true;
+            break;
+        case 'H': hybrid = true; break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                printf("Error: number of threads must be positive\n");
+                return 1;
+            }
+            block_options = true;
+            break;
         case 'h': print_help(); return 0;
         default: print_help(); return 1;
         }
     }
 
-    // Open public key file
-    FILE *f = fopen(pbfile, "r");
-    if (!f) {
-        printf("Error: could not open public key file %s\n", pbfile);
+    // Hybrid and multi-recipient files are always binary and encrypted on one thread
+    if (block_options && (hybrid || recipients > 1)) {
+        printf("Error: -j and -x cannot be used with -H or several public keys\n");
         return 1;
     }
 
-    // Read the public key from the opened public key file
-    mpz_t n;
-    mpz_init(n);
-
-    char hex_key[512];
-    if (fgets(hex_key, 512, f) == NULL) {
-        printf("Error: invalid public key file format\n");
+    // Read every public key, the default one if none were given
+    if (recipients == 0) {
+        recipients = 1;
+    }
+    Keystore *ks = kspath != NULL ? keystore_open(kspath) : NULL;
+    if (kspath != NULL && ks == NULL) {
         return 1;
     }
+    mpz_t n[MAX_RECIPIENTS];
+    for (uint32_t i = 0; i < recipients; i++) {
+        mpz_init(n[i]);
+        char username[128];
+        if (by_name[i]) {
+            uint32_t index = ks != NULL ? keystore_find(ks, pbfiles[i]) : KEYSTORE_NOT_FOUND;
+            if (index == KEYSTORE_NOT_FOUND) {
+                printf("Error: no public key for %s in the keystore\n", pbfiles[i]);
+                return 1;
+            }
+            keystore_pub(ks, index, n[i]);
+            snprintf(username, sizeof(username), "%s", pbfiles[i]);
+        } else if (!read_pub(pbfiles[i], n[i], username, sizeof(username))) {
+            return 1;
+        }
 
-    if (mpz_set_str(n, hex_key, 16) == -1) {
-        printf("Error: invalid public key file format\n");
-        return 1;
+        // Print verbose output if enabled
+        if (verbose) {
+            uint8_t fingerprint[SS_FINGERPRINT_SIZE];
+            ss_fingerprint(fingerprint, n[i]);
+            gmp_printf("user = %s\n", username);
+            gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n[i], 2), n[i]);
+            printf("fingerprint = ");
+            for (int j = 0; j < SS_FINGERPRINT_SIZE; j++) {
+                printf("%02x", fingerprint[j]);
+            }
+            printf("\n");
+        }
     }
 
-    char username[128];
-    if (fgets(username, 128, f) == NULL) {
-        printf("Error: invalid public key file format\n");
-        return 1;
+    // Encrypt input file
+    // Read and write in large chunks; records are small compared to a syscall
+    setvbuf(infile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    setvbuf(outfile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bytes = 0;
+    if (recipients > 1) {
+        bytes = ss_encrypt_file_multi(infile, outfile, (const mpz_t *) n, recipients);
+    } else if (hybrid) {
+        bytes = ss_encrypt_file_hybrid(infile, outfile, n[0]);
+    } else {
+        bytes = ss_encrypt_file_threads(infile, outfile, n[0], threads, !hex);
     }
-    username[strcspn(username, "\n")] = 0;
+    fflush(outfile);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    // Print verbose output if enabled
+    // Report throughput on stderr, so it does not end up in the ciphertext on stdout
     if (verbose) {
-        gmp_printf("user = %s\n", username);
-        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Encrypted %" PRIu64 " bytes in %.3f s (%.2f MB/s, %zu-bit key)\n", bytes,
+            seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0, mpz_sizeinbase(n[0], 2));
+        if (!hybrid && recipients == 1) {
+            fprintf(stderr, "%zu bytes per block, %.1f exponentiations per MB\n",
+                ss_block_size(n[0]) - 1, 1e6 / (ss_block_size(n[0]) - 1));
+        }
+        profile_report(stderr);
     }
 
-    // Encrypt input file
-    ss_encrypt_file(infile, outfile, n);
-
     // Clean up
-    fclose(f);
-    mpz_clear(n);
+    for (uint32_t i = 0; i < recipients; i++) {
+        mpz_clear(n[i]);
+    }
+    if (ks != NULL) {
+        keystore_close(ks);
+    }
 
     return 0;
 }
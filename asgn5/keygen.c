@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <time.h>
@@ -9,7 +11,10 @@
 #include <sys/types.h>
 #include <gmp.h>
 
+#include "keystore.h"
 #include "numtheory.h"
+#include "pool.h"
+#include "profile.h"
 #include "randstate.h"
 #include "ss.h"
 
@@ -19,6 +24,22 @@
 #define PERM_PRIVATE_KEY     0600
 #define MIN_BITS             256
 
+static struct option long_options[] = {
+    { "batch", required_argument, NULL, 'B' },
+    { NULL, 0, NULL, 0 },
+};
+
+// A batch of keypairs, one per user, shared by the threads of a pool.
+typedef struct Batch {
+    char **users;
+    size_t count;
+    int bits;
+    int iters;
+    RandStream *streams; // one per user, so each key only depends on the seed and its position
+    atomic_size_t next; // next user to generate a keypair for
+    atomic_bool failed;
+} Batch;
+
 // Print usage information.
 void print_help(void) {
     printf("SYNOPSIS\n");
@@ -35,6 +56,167 @@ void print_help(void) {
     printf("   -n pbfile       Public key file (default: ss.pub).\n");
     printf("   -d pvfile       Private key file (default: ss.priv).\n");
     printf("   -s seed         Random seed for testing.\n");
+    printf("   -j threads      Number of threads to search for primes on (default: 1).\n");
+    printf("   --batch users   Generate user.pub and user.priv for every user listed in\n");
+    printf("                   the file users, one per line, on -j threads.\n");
+}
+
+// Generates one keypair from rs and writes it to user.pub and user.priv. Returns false on error.
+static bool write_keypair(const char *user, int bits, int iters, RandStream *rs) {
+    char *pubkeyfile = malloc(strlen(user) + 6);
+    char *privkeyfile = malloc(strlen(user) + 6);
+    if (pubkeyfile == NULL || privkeyfile == NULL) {
+        fprintf(stderr, "Error: could not allocate memory for key file names\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(pubkeyfile, "%s.pub", user);
+    sprintf(privkeyfile, "%s.priv", user);
+
+    FILE *pubkey = fopen(pubkeyfile, "w");
+    FILE *privkey = fopen(privkeyfile, "w");
+    bool ok = pubkey != NULL && privkey != NULL
+              && fchmod(fileno(privkey), PERM_PRIVATE_KEY) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error: could not open key files for user %s\n", user);
+    } else {
+        mpz_t p, q, n;
+        mpz_inits(p, q, n, NULL);
+        SSPriv key;
+        ss_priv_init(&key);
+
+        ss_make_pub_stream(p, q, n, bits, iters, rs);
+        ss_make_priv_key(&key, p, q);
+        ss_write_pub(n, user, pubkey);
+        ss_write_priv_key(&key, privkey);
+
+        mpz_clears(p, q, n, NULL);
+        ss_priv_clear(&key);
+    }
+
+    if (pubkey != NULL) {
+        fclose(pubkey);
+    }
+    if (privkey != NULL) {
+        fclose(privkey);
+    }
+    free(pubkeyfile);
+    free(privkeyfile);
+    return ok;
+}
+
+// Generates keypairs for the users of a batch until there are none left.
+static void batch_task(void *arg, int id, int threads) {
+    (void) id;
+    (void) threads;
+    Batch *batch = (Batch *) arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        if (!write_keypair(batch->users[i], batch->bits, batch->iters, &batch->streams[i])) {
+            atomic_store(&batch->failed, true);
+        }
+    }
+}
+
+// Generates a keypair for every user listed in path, one name per line, on threads threads, and
+// reports how many keys per second were generated. Returns the exit status of keygen.
+static int keygen_batch(const char *path, int bits, int iters, int threads) {
+    FILE *list = fopen(path, "r");
+    if (list == NULL) {
+        fprintf(stderr, "Error: could not open batch file %s\n", path);
+        return 1;
+    }
+
+    // Read every user name up front, indexing them by hash to refuse duplicates. names holds a
+    // user number plus one per slot and stays at least twice as large as users.
+    Batch batch;
+    batch.users = NULL;
+    batch.count = 0;
+    size_t capacity = 0;
+    uint32_t *names = NULL;
+    size_t mask = 0;
+    char *line = NULL;
+    size_t len = 0;
+    bool valid = true;
+    while (valid && getline(&line, &len, list) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (strchr(line, '/') != NULL) {
+            fprintf(stderr, "Error: invalid user name %s\n", line);
+            valid = false;
+            break;
+        }
+        if (batch.count == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            batch.users = (char **) realloc(batch.users, capacity * sizeof(char *));
+            free(names);
+            names = (uint32_t *) calloc(2 * capacity, sizeof(uint32_t));
+            if (batch.users == NULL || names == NULL) {
+                fprintf(stderr, "Error: could not allocate memory for user names\n");
+                exit(EXIT_FAILURE);
+            }
+            mask = 2 * capacity - 1;
+            for (size_t i = 0; i < batch.count; i++) {
+                size_t b = keystore_hash(batch.users[i]) & mask;
+                while (names[b] != 0) {
+                    b = (b + 1) & mask;
+                }
+                names[b] = i + 1;
+            }
+        }
+        size_t b = keystore_hash(line) & mask;
+        for (; names[b] != 0 && valid; b = (b + 1) & mask) {
+            if (strcmp(batch.users[names[b] - 1], line) == 0) {
+                fprintf(stderr, "Error: user name %s appears twice\n", line);
+                valid = false;
+            }
+        }
+        if (valid) {
+            names[b] = batch.count + 1;
+            batch.users[batch.count++] = strdup(line);
+        }
+    }
+    free(names);
+    free(line);
+    fclose(list);
+    if (!valid) {
+        for (size_t i = 0; i < batch.count; i++) {
+            free(batch.users[i]);
+        }
+        free(batch.users);
+        return 1;
+    }
+
+    batch.bits = bits;
+    batch.iters = iters;
+    batch.streams = (RandStream *) malloc((batch.count + 1) * sizeof(RandStream));
+    if (batch.streams == NULL) {
+        fprintf(stderr, "Error: could not allocate memory for random streams\n");
+        exit(EXIT_FAILURE);
+    }
+    randstate_streams(batch.streams, batch.count);
+    atomic_init(&batch.next, 0);
+    atomic_init(&batch.failed, false);
+
+    // Every thread generates whole keypairs, taking the next user whenever it finishes one
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Pool *pool = pool_create(threads);
+    pool_run(pool, batch_task, &batch);
+    pool_delete(pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu keypairs in %.3f s (%.2f keys/sec)\n", batch.count, seconds,
+        seconds > 0 ? batch.count / seconds : 0.0);
+
+    for (size_t i = 0; i < batch.count; i++) {
+        free(batch.users[i]);
+    }
+    free(batch.users);
+    free(batch.streams);
+    return atomic_load(&batch.failed) ? 1 : 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -45,8 +227,10 @@ int main(int argc, char *argv[]) {
     char *privkeyfile = DEFAULT_PRIVKEY_FILE;
     unsigned long seed = time(NULL);
     bool verbose = false;
+    int threads = 1;
+    char *batchfile = NULL;
 
-    while ((opt = getopt(argc, argv, "b:i:n:d:s:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "b:i:n:d:s:j:vh", long_options, NULL)) != -1) {
         switch (opt) {
         case 'b': bits = atoi(optarg); break;
         case 'i': iters = atoi(optarg); break;
@@ -54,11 +238,27 @@ int main(int argc, char *argv[]) {
         case 'd': privkeyfile = optarg; break;
         case 's': seed = strtoul(optarg, NULL, 0); break;
         case 'v': verbose = true; break;
+        case 'B': batchfile = optarg; break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                printf("Error: number of threads must be positive\n");
+                return 1;
+            }
+            break;
         case 'h': print_help(); return 0;
         default: print_help(); return 1;
         }
     }
 
+    // Batch mode writes its own key files
+    if (batchfile != NULL) {
+        randstate_init(seed);
+        int status = keygen_batch(batchfile, bits, iters, threads);
+        randstate_clear();
+        return status;
+    }
+
     // Open the public and private key files.
     FILE *pubkey = fopen(pubkeyfile, "w");
     if (pubkey == NULL) {
@@ -91,15 +291,18 @@ int main(int argc, char *argv[]) {
     randstate_init(seed);
 
     // Generate public and private keys.
-    mpz_t p, q, n, e, d, pq;
-    mpz_inits(p, q, n, e, d, pq, NULL);
+    mpz_t p, q, n;
+    mpz_inits(p, q, n, NULL);
+    SSPriv key;
+    ss_priv_init(&key);
 
-    ss_make_pub(p, q, n, bits, iters);
-    ss_make_priv(d, pq, p, q);
+    ss_make_pub_threads(p, q, n, bits, iters, threads);
+    ss_make_priv_key(&key, p, q);
 
     // Writing the computed public and private key to their respective files.
+    // The private key file holds the CRT components too so decrypt can use them.
     ss_write_pub(n, username, pubkey);
-    ss_write_priv(pq, d, privkey);
+    ss_write_priv_key(&key, privkey);
 
     // Print verbose if -v is enabled.
     if (verbose == true) {
@@ -107,15 +310,17 @@ int main(int argc, char *argv[]) {
         printf("p  (%lu bits) = %s\n", mpz_sizeinbase(p, 2), mpz_get_str(NULL, 10, p));
         printf("q  (%lu bits) = %s\n", mpz_sizeinbase(q, 2), mpz_get_str(NULL, 10, q));
         printf("n  (%lu bits) = %s\n", mpz_sizeinbase(n, 2), mpz_get_str(NULL, 10, n));
-        printf("pq (%lu bits) = %s\n", mpz_sizeinbase(pq, 2), mpz_get_str(NULL, 10, pq));
-        printf("d  (%lu bits) = %s\n", mpz_sizeinbase(d, 2), mpz_get_str(NULL, 10, d));
+        printf("pq (%lu bits) = %s\n", mpz_sizeinbase(key.pq, 2), mpz_get_str(NULL, 10, key.pq));
+        printf("d  (%lu bits) = %s\n", mpz_sizeinbase(key.d, 2), mpz_get_str(NULL, 10, key.d));
+        profile_report(stdout);
     }
 
     // Close the public and private key files, clear the random state with randstate_clear(), and clear any mpz_t variables used.
     fclose(pubkey);
     fclose(privkey);
     randstate_clear();
-    mpz_clears(p, q, n, d, pq, NULL);
+    mpz_clears(p, q, n, NULL);
+    ss_priv_clear(&key);
 
     return 0;
 }
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keystore.h"
+#include "ss.h"
+
+// Bytes of a record before its numbers: username, fingerprint, flags and a reserved field.
+#define KEYSTORE_RECORD_PREFIX (KEYSTORE_NAME_SIZE + SS_FINGERPRINT_SIZE + 8)
+
+// Largest width accepted when opening a keystore, so sizes cannot overflow.
+#define KEYSTORE_MAX_WIDTH (1 << 20)
+
+struct Keystore {
+    const uint8_t *base; // the mapped file
+    size_t size;
+    uint32_t count;
+    uint32_t buckets;
+    uint32_t width;
+    size_t record_size;
+    const uint8_t *names; // username index
+    const uint8_t *fingerprints; // fingerprint index
+    const uint8_t *records;
+};
+
+// Stores the low size bytes of value at bytes, least significant first.
+static void keystore_put_le(uint8_t *bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// Loads a size-byte little-endian value from bytes.
+static uint64_t keystore_get_le(const uint8_t *bytes, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// 64-bit FNV-1a hash of a username, as ss_fingerprint uses for public keys.
+uint64_t keystore_hash(const char *username) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const uint8_t *c = (const uint8_t *) username; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Bytes of a record whose numbers are width bytes each.
+static size_t keystore_record_size(uint32_t width) {
+    return KEYSTORE_RECORD_PREFIX + (size_t) KEYSTORE_FIELDS * width;
+}
+
+// Stores x big-endian in the width bytes at field, zero-padded on the left. Returns false if x
+// does not fit.
+static bool keystore_put_number(uint8_t *field, const mpz_t x, uint32_t width) {
+    if (mpz_sgn(x) == 0) {
+        return true;
+    }
+    size_t size = (mpz_sizeinbase(x, 2) + 7) / 8;
+    if (size > width) {
+        return false;
+    }
+    mpz_export(field + width - size, NULL, 1, 1, 1, 0, x);
+    return true;
+}
+
+bool keystore_write(FILE *outfile, const KeystoreEntry entries[], uint32_t count) {
+    // Every number is as wide as the widest public key
+    uint32_t width = 1;
+    for (uint32_t i = 0; i < count; i++) {
+        if (strlen(entries[i].username) >= KEYSTORE_NAME_SIZE) {
+            fprintf(stderr, "Error: username %s is longer than %d bytes.\n", entries[i].username,
+                KEYSTORE_NAME_SIZE - 1);
+            return false;
+        }
+        uint32_t size = (mpz_sizeinbase(entries[i].n, 2) + 7) / 8;
+        width = size > width ? size : width;
+    }
+
+    // At least twice as many buckets as records keeps probes short
+    uint32_t buckets = 1;
+    while (buckets <= 2 * (uint64_t) count) {
+        buckets <<= 1;
+    }
+    // The whole file is built in memory and only written once every record has been encoded, so
+    // a key that does not fit leaves nothing behind in outfile
+    size_t record_size = keystore_record_size(width);
+    size_t size = KEYSTORE_HEADER_SIZE + 8 * (size_t) buckets + count * record_size;
+    uint32_t *names = (uint32_t *) calloc(buckets, sizeof(uint32_t));
+    uint32_t *fingerprints = (uint32_t *) calloc(buckets, sizeof(uint32_t));
+    uint8_t *fps = (uint8_t *) malloc((size_t) count * SS_FINGERPRINT_SIZE + 1);
+    uint8_t *image = (uint8_t *) calloc(size, 1);
+    if (names == NULL || fingerprints == NULL || fps == NULL || image == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for keystore.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Build both indexes, refusing duplicates
+    bool valid = true;
+    uint32_t mask = buckets - 1;
+    for (uint32_t i = 0; i < count && valid; i++) {
+        uint32_t b = keystore_hash(entries[i].username) & mask;
+        for (; names[b] != 0; b = (b + 1) & mask) {
+            if (strcmp(entries[names[b] - 1].username, entries[i].username) == 0) {
+                fprintf(stderr, "Error: username %s appears twice.\n", entries[i].username);
+                valid = false;
+                break;
+            }
+        }
+        names[b] = i + 1;
+
+        uint8_t *fp = fps + (size_t) i * SS_FINGERPRINT_SIZE;
+        ss_fingerprint(fp, entries[i].n);
+        b = keystore_get_le(fp, SS_FINGERPRINT_SIZE) & mask;
+        for (; fingerprints[b] != 0 && valid; b = (b + 1) & mask) {
+            uint8_t *other = fps + (size_t) (fingerprints[b] - 1) * SS_FINGERPRINT_SIZE;
+            if (memcmp(other, fp, SS_FINGERPRINT_SIZE) == 0
+                && mpz_cmp(entries[fingerprints[b] - 1].n, entries[i].n) == 0) {
+                fprintf(stderr, "Error: the key of %s appears twice.\n", entries[i].username);
+                valid = false;
+            }
+        }
+        fingerprints[b] = i + 1;
+    }
+
+    memcpy(image, KEYSTORE_MAGIC, 4);
+    keystore_put_le(image + 4, KEYSTORE_VERSION, 2);
+    keystore_put_le(image + 8, count, 4);
+    keystore_put_le(image + 12, buckets, 4);
+    keystore_put_le(image + 16, width, 4);
+    uint8_t *index = image + KEYSTORE_HEADER_SIZE;
+    for (uint32_t i = 0; i < buckets; i++) {
+        keystore_put_le(index + 4 * i, names[i], 4);
+        keystore_put_le(index + 4 * ((size_t) buckets + i), fingerprints[i], 4);
+    }
+
+    for (uint32_t i = 0; i < count && valid; i++) {
+        const KeystoreEntry *entry = &entries[i];
+        const SSPriv *key = entry->key;
+        uint8_t *bytes = index + 8 * (size_t) buckets + i * record_size;
+        memcpy(bytes, entry->username, strlen(entry->username));
+        memcpy(bytes + KEYSTORE_NAME_SIZE, fps + (size_t) i * SS_FINGERPRINT_SIZE,
+            SS_FINGERPRINT_SIZE);
+        uint32_t flags = 0;
+        if (key != NULL) {
+            flags = key->crt ? KEYSTORE_PRIVATE | KEYSTORE_CRT : KEYSTORE_PRIVATE;
+        }
+        keystore_put_le(bytes + KEYSTORE_NAME_SIZE + SS_FINGERPRINT_SIZE, flags, 4);
+
+        mpz_srcptr fields[KEYSTORE_FIELDS] = { entry->n };
+        if (key != NULL) {
+            fields[1] = key->pq;
+            fields[2] = key->d;
+        }
+        if (key != NULL && key->crt) {
+            fields[3] = key->p;
+            fields[4] = key->q;
+            fields[5] = key->dp;
+            fields[6] = key->dq;
+            fields[7] = key->qinv;
+        }
+        uint8_t *field = bytes + KEYSTORE_RECORD_PREFIX;
+        for (int f = 0; f < KEYSTORE_FIELDS && valid; f++, field += width) {
+            if (fields[f] != NULL && !keystore_put_number(field, fields[f], width)) {
+                fprintf(stderr, "Error: the private key of %s is larger than its public key.\n",
+                    entry->username);
+                valid = false;
+            }
+        }
+    }
+
+    if (valid && fwrite(image, 1, size, outfile) != size) {
+        fprintf(stderr, "Error: could not write keystore.\n");
+        valid = false;
+    }
+    free(names);
+    free(fingerprints);
+    free(fps);
+    free(image);
+    return valid;
+}
+
+Keystore *keystore_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: could not open keystore %s\n", path);
+        return NULL;
+    }
+    struct stat stats;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &stats) == 0 && stats.st_size >= KEYSTORE_HEADER_SIZE) {
+        base = mmap(NULL, stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error: %s is not a keystore\n", path);
+        return NULL;
+    }
+
+    // Check the header, and that the file is exactly as long as it says
+    Keystore *ks = (Keystore *) malloc(sizeof(Keystore));
+    if (ks == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for keystore.\n");
+        exit(EXIT_FAILURE);
+    }
+    const uint8_t *header = (const uint8_t *) base;
+    ks->base = header;
+    ks->size = stats.st_size;
+    ks->count = keystore_get_le(header + 8, 4);
+    ks->buckets = keystore_get_le(header + 12, 4);
+    ks->width = keystore_get_le(header + 16, 4);
+    ks->record_size = keystore_record_size(ks->width);
+    bool valid = memcmp(header, KEYSTORE_MAGIC, 4) == 0
+                 && keystore_get_le(header + 4, 2) == KEYSTORE_VERSION && ks->width > 0
+                 && ks->width <= KEYSTORE_MAX_WIDTH && ks->buckets > ks->count
+                 && (ks->buckets & (ks->buckets - 1)) == 0
+                 && ks->size
+                        == KEYSTORE_HEADER_SIZE + 8 * (uint64_t) ks->buckets
+                               + (uint64_t) ks->count * ks->record_size;
+    if (!valid) {
+        fprintf(stderr, "Error: %s is not a keystore\n", path);
+        munmap(base, ks->size);
+        free(ks);
+        return NULL;
+    }
+    ks->names = header + KEYSTORE_HEADER_SIZE;
+    ks->fingerprints = ks->names + 4 * (size_t) ks->buckets;
+    ks->records = ks->fingerprints + 4 * (size_t) ks->buckets;
+    return ks;
+}
+
+void keystore_close(Keystore *ks) {
+    munmap((void *) ks->base, ks->size);
+    free(ks);
+}
+
+uint32_t keystore_count(const Keystore *ks) {
+    return ks->count;
+}
+
+// Returns the start of record index.
+static const uint8_t *keystore_record(const Keystore *ks, uint32_t index) {
+    return ks->records + (size_t) index * ks->record_size;
+}
+
+uint32_t keystore_find(const Keystore *ks, const char *username) {
+    uint32_t mask = ks->buckets - 1;
+    uint32_t b = keystore_hash(username) & mask;
+    for (uint32_t probes = 0; probes < ks->buckets; probes++, b = (b + 1) & mask) {
+        uint32_t slot = keystore_get_le(ks->names + 4 * (size_t) b, 4);
+        if (slot == 0) {
+            break;
+        }
+        if (slot <= ks->count
+            && strncmp((const char *) keystore_record(ks, slot - 1), username, KEYSTORE_NAME_SIZE)
+                   == 0) {
+            return slot - 1;
+        }
+    }
+    return KEYSTORE_NOT_FOUND;
+}
+
+uint32_t keystore_find_fingerprint(const Keystore *ks, const uint8_t *fingerprint) {
+    uint32_t mask = ks->buckets - 1;
+    uint32_t b = keystore_get_le(fingerprint, SS_FINGERPRINT_SIZE) & mask;
+    for (uint32_t probes = 0; probes < ks->buckets; probes++, b = (b + 1) & mask) {
+        uint32_t slot = keystore_get_le(ks->fingerprints + 4 * (size_t) b, 4);
+        if (slot == 0) {
+            break;
+        }
+        if (slot <= ks->count
+            && memcmp(keystore_record(ks, slot - 1) + KEYSTORE_NAME_SIZE, fingerprint,
+                   SS_FINGERPRINT_SIZE)
+                   == 0) {
+            return slot - 1;
+        }
+    }
+    return KEYSTORE_NOT_FOUND;
+}
+
+void keystore_username(const Keystore *ks, uint32_t index, char *username) {
+    memcpy(username, keystore_record(ks, index), KEYSTORE_NAME_SIZE - 1);
+    username[KEYSTORE_NAME_SIZE - 1] = '\0';
+}
+
+void keystore_fingerprint(const Keystore *ks, uint32_t index, uint8_t *fingerprint) {
+    memcpy(fingerprint, keystore_record(ks, index) + KEYSTORE_NAME_SIZE, SS_FINGERPRINT_SIZE);
+}
+
+void keystore_pub(const Keystore *ks, uint32_t index, mpz_t n) {
+    mpz_import(n, ks->width, 1, 1, 1, 0, keystore_record(ks, index) + KEYSTORE_RECORD_PREFIX);
+}
+
+bool keystore_priv(const Keystore *ks, uint32_t index, SSPriv *key) {
+    const uint8_t *record = keystore_record(ks, index);
+    uint32_t flags = keystore_get_le(record + KEYSTORE_NAME_SIZE + SS_FINGERPRINT_SIZE, 4);
+    if ((flags & KEYSTORE_PRIVATE) == 0) {
+        return false;
+    }
+
+    // Fields 1 to 7 of the record, in the order of KEYSTORE_FIELDS
+    mpz_ptr fields[] = { key->pq, key->d, key->p, key->q, key->dp, key->dq, key->qinv };
+    int count = (flags & KEYSTORE_CRT) != 0 ? 7 : 2;
+    const uint8_t *field = record + KEYSTORE_RECORD_PREFIX + ks->width;
+    for (int f = 0; f < count; f++, field += ks->width) {
+        mpz_import(fields[f], ks->width, 1, 1, 1, 0, field);
+    }
+    key->crt = count == 7 && ss_priv_crt_valid(key);
+    return mpz_cmp_ui(key->pq, 0) != 0 && mpz_cmp_ui(key->d, 0) != 0;
+}
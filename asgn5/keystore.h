@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ss.h"
+
+#define KEYSTORE_MAGIC       "SSKS" // Starts every keystore file.
+#define KEYSTORE_VERSION     1
+#define KEYSTORE_HEADER_SIZE 24 // Bytes in a keystore header.
+#define KEYSTORE_NAME_SIZE   64 // Bytes of a username in a record, including the NUL.
+#define KEYSTORE_FIELDS      8 // Numbers in a record: n, pq, d, p, q, dp, dq and qinv.
+#define KEYSTORE_NOT_FOUND   UINT32_MAX
+
+#define KEYSTORE_PRIVATE 1 // Record flag: the record holds pq and d.
+#define KEYSTORE_CRT     2 // Record flag: the record also holds p, q, dp, dq and qinv.
+
+//
+// A keystore file holds many keys in one file that is memory-mapped, so a service opens it once
+// and then looks keys up without reading or parsing anything.
+//
+// All fields are little-endian. The header is KEYSTORE_MAGIC, a 16-bit version, a reserved 16-bit
+// field, the 32-bit record count, bucket count and width, and a reserved 32-bit field. Two hash
+// indexes of buckets 32-bit slots follow, by username and by fingerprint: a slot holds a record
+// number plus one, or 0 if it is empty, and collisions go to the next slot. buckets is a power of
+// two larger than count, so every probe ends at an empty slot.
+//
+// The records follow. Each is the username padded with NULs to KEYSTORE_NAME_SIZE bytes, the
+// fingerprint of n (see ss_fingerprint), 32-bit flags, a reserved 32-bit field, and then the
+// KEYSTORE_FIELDS numbers in the order above, each big-endian and zero-padded to width bytes like
+// a ciphertext record. Numbers a record does not hold are zero.
+//
+typedef struct Keystore Keystore;
+
+//
+// A key to be written to a keystore.
+//
+typedef struct KeystoreEntry {
+    const char *username; // shorter than KEYSTORE_NAME_SIZE bytes
+    mpz_srcptr n; // public key
+    const SSPriv *key; // private key, NULL to store the public key only
+} KeystoreEntry;
+
+//
+// Returns the 64-bit FNV-1a hash of username that both indexes of a keystore probe from.
+//
+uint64_t keystore_hash(const char *username);
+
+//
+// Writes a keystore holding count entries to outfile. Returns false and prints an error if a
+// username is too long, if two entries have the same username or the same public key, or if the
+// file cannot be written; nothing is written unless every entry could be encoded.
+//
+bool keystore_write(FILE *outfile, const KeystoreEntry entries[], uint32_t count);
+
+//
+// Maps the keystore file at path. Returns NULL and prints an error if it cannot be opened or is
+// not a keystore. Several threads may look keys up in the same keystore at once.
+//
+Keystore *keystore_open(const char *path);
+
+//
+// Unmaps a keystore.
+//
+void keystore_close(Keystore *ks);
+
+//
+// Returns the number of records in a keystore.
+//
+uint32_t keystore_count(const Keystore *ks);
+
+//
+// Returns the number of the record of username, or KEYSTORE_NOT_FOUND.
+//
+uint32_t keystore_find(const Keystore *ks, const char *username);
+
+//
+// Returns the number of the record whose public key has the given fingerprint (SS_FINGERPRINT_SIZE
+// bytes), or KEYSTORE_NOT_FOUND.
+//
+uint32_t keystore_find_fingerprint(const Keystore *ks, const uint8_t *fingerprint);
+
+//
+// Copies the username of record index into username, which holds KEYSTORE_NAME_SIZE bytes.
+//
+void keystore_username(const Keystore *ks, uint32_t index, char *username);
+
+//
+// Copies the fingerprint of record index into fingerprint, which holds SS_FINGERPRINT_SIZE bytes.
+//
+void keystore_fingerprint(const Keystore *ks, uint32_t index, uint8_t *fingerprint);
+
+//
+// Sets n to the public key of record index.
+//
+void keystore_pub(const Keystore *ks, uint32_t index, mpz_t n);
+
+//
+// Sets key, initialized with ss_priv_init, to the private key of record index, with crt set only
+// if its CRT components agree (see ss_priv_crt_valid). Returns false if the record only holds a
+// public key.
+//
+bool keystore_priv(const Keystore *ks, uint32_t index, SSPriv *key);
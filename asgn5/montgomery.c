@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "montgomery.h"
+#include "profile.h"
+
+// Allocates count limbs, exiting if memory runs out like the rest of the SS library.
+static mp_limb_t *limbs_alloc(mp_size_t count) {
+    mp_limb_t *limbs = (mp_limb_t *) calloc(count, sizeof(mp_limb_t));
+    if (limbs == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for limbs.\n");
+        exit(EXIT_FAILURE);
+    }
+    return limbs;
+}
+
+// Copies x, which must be less than the modulus, into n zero-padded limbs.
+static void limbs_from_mpz(mp_limb_t *rp, const mpz_t x, mp_size_t n) {
+    mp_size_t size = mpz_size(x);
+    if (size > 0) {
+        mpn_copyi(rp, mpz_limbs_read(x), size);
+    }
+    if (size < n) {
+        mpn_zero(rp + size, n - size);
+    }
+}
+
+// Reduces the 2n-limb product in ctx->t into rp: rp = t * R^-1 mod m (REDC).
+static void mont_redc(mp_limb_t *rp, MontCtx *ctx) {
+    mp_size_t n = ctx->n;
+    mp_limb_t *t = ctx->t;
+    PROFILE_COUNT(PROFILE_REDC, 1);
+
+    // Clear one low limb per step; the carry out of each step belongs n limbs up, so park it in
+    // the limb just zeroed and add all of them in at once
+    for (mp_size_t i = 0; i < n; i++) {
+        mp_limb_t u = t[i] * ctx->minv;
+        t[i] = mpn_addmul_1(t + i, ctx->m, n, u);
+    }
+    mp_limb_t carry = mpn_add_n(rp, t + n, t, n);
+
+    // The result is less than 2m, so one subtraction brings it below m
+    if (carry != 0 || mpn_cmp(rp, ctx->m, n) >= 0) {
+        mpn_sub_n(rp, rp, ctx->m, n);
+    }
+}
+
+// rp = a * b * R^-1 mod m. rp may alias a or b.
+static void mont_mul(mp_limb_t *rp, const mp_limb_t *a, const mp_limb_t *b, MontCtx *ctx) {
+    if (a == b) {
+        PROFILE_COUNT(PROFILE_SQR, 1);
+        mpn_sqr(ctx->t, a, ctx->n);
+    } else {
+        PROFILE_COUNT(PROFILE_MODMUL, 1);
+        mpn_mul_n(ctx->t, a, b, ctx->n);
+    }
+    mont_redc(rp, ctx);
+}
+
+void mont_init(MontCtx *ctx, const mpz_t m) {
+    mp_size_t n = mpz_size(m);
+    ctx->n = n;
+    ctx->m = limbs_alloc(n);
+    ctx->r2 = limbs_alloc(n);
+    ctx->one = limbs_alloc(n);
+    ctx->t = limbs_alloc(2 * n + 1);
+    ctx->acc = limbs_alloc(n);
+    ctx->table = limbs_alloc(((mp_size_t) 1 << (MONT_MAX_WINDOW - 1)) * n);
+    limbs_from_mpz(ctx->m, m, n);
+    mpz_init_set(ctx->mod, m);
+    mpz_init2(ctx->base, n * GMP_NUMB_BITS);
+
+    // Newton's iteration doubles the correct low bits of m^-1 each step, starting from 3
+    mp_limb_t m0 = ctx->m[0];
+    mp_limb_t inv = m0;
+    for (int i = 0; i < 6; i++) {
+        inv *= 2 - m0 * inv;
+    }
+    ctx->minv = -inv;
+
+    // R mod m and R^2 mod m are the only divisions needed
+    mpz_t r;
+    mpz_init(r);
+    mpz_setbit(r, n * GMP_NUMB_BITS);
+    mpz_mod(r, r, m);
+    limbs_from_mpz(ctx->one, r, n);
+    mpz_set_ui(r, 0);
+    mpz_setbit(r, 2 * n * GMP_NUMB_BITS);
+    mpz_mod(r, r, m);
+    limbs_from_mpz(ctx->r2, r, n);
+    mpz_clear(r);
+}
+
+void mont_clear(MontCtx *ctx) {
+    free(ctx->m);
+    free(ctx->r2);
+    free(ctx->one);
+    free(ctx->t);
+    free(ctx->acc);
+    free(ctx->table);
+    mpz_clears(ctx->mod, ctx->base, NULL);
+}
+
+int mont_window(uint64_t bits) {
+    // Larger windows trade table entries (2^(w-1) multiplications) for fewer multiplications
+    // along the exponent (about bits / (w + 1))
+    if (bits > 671) {
+        return 6;
+    } else if (bits > 239) {
+        return 5;
+    } else if (bits > 79) {
+        return 4;
+    } else if (bits > 23) {
+        return 3;
+    }
+    return 1;
+}
+
+void mont_recode(MontRecoding *rec, const mpz_t exponent) {
+    uint64_t bits = mpz_sizeinbase(exponent, 2);
+    int w = mont_window(bits);
+
+    // There is at most one window per bit
+    rec->w = w;
+    rec->count = 0;
+    rec->squarings = (uint32_t *) malloc(bits * sizeof(uint32_t));
+    rec->index = (uint32_t *) malloc(bits * sizeof(uint32_t));
+    if (rec->squarings == NULL || rec->index == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for exponent recoding.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Scan the exponent from the top, squaring for each bit and multiplying once per window of
+    // up to w bits that starts and ends with a 1
+    uint32_t pending = 0;
+    int64_t i = bits - 1;
+    while (i >= 0) {
+        if (!mpz_tstbit(exponent, i)) {
+            pending++;
+            i--;
+            continue;
+        }
+
+        int64_t j = i - w + 1 < 0 ? 0 : i - w + 1;
+        while (!mpz_tstbit(exponent, j)) {
+            j++;
+        }
+        uint32_t value = 0;
+        for (int64_t k = i; k >= j; k--) {
+            value = (value << 1) | mpz_tstbit(exponent, k);
+        }
+
+        rec->squarings[rec->count] = rec->count == 0 ? 0 : pending + (i - j + 1);
+        rec->index[rec->count] = value >> 1;
+        rec->count++;
+        pending = 0;
+        i = j - 1;
+    }
+    rec->tail = pending;
+}
+
+void mont_recoding_clear(MontRecoding *rec) {
+    free(rec->squarings);
+    free(rec->index);
+}
+
+void mont_pow_recoded(mpz_t out, const mpz_t base, const MontRecoding *rec, MontCtx *ctx) {
+    PROFILE_START(start);
+    mp_size_t n = ctx->n;
+    mp_limb_t *acc = ctx->acc;
+
+    // Bring the base below m and into Montgomery form as table[0] = g
+    mpz_mod(ctx->base, base, ctx->mod);
+    limbs_from_mpz(acc, ctx->base, n);
+    mont_mul(ctx->table, acc, ctx->r2, ctx);
+
+    // table[i] = g^(2i + 1)
+    mp_size_t entries = (mp_size_t) 1 << (rec->w - 1);
+    if (entries > 1) {
+        mont_mul(acc, ctx->table, ctx->table, ctx);
+        for (mp_size_t i = 1; i < entries; i++) {
+            mont_mul(ctx->table + i * n, ctx->table + (i - 1) * n, acc, ctx);
+        }
+    }
+
+    mpn_copyi(acc, ctx->table + rec->index[0] * n, n);
+    for (size_t i = 1; i < rec->count; i++) {
+        for (uint32_t k = 0; k < rec->squarings[i]; k++) {
+            mont_mul(acc, acc, acc, ctx);
+        }
+        mont_mul(acc, acc, ctx->table + rec->index[i] * n, ctx);
+    }
+    for (uint32_t k = 0; k < rec->tail; k++) {
+        mont_mul(acc, acc, acc, ctx);
+    }
+
+    // Multiply by 1 to leave Montgomery form
+    mpn_copyi(ctx->t, acc, n);
+    mpn_zero(ctx->t + n, n + 1);
+    mont_redc(acc, ctx);
+    mpz_import(out, n, -1, sizeof(mp_limb_t), 0, GMP_NAIL_BITS, acc);
+    PROFILE_MODEXP(start);
+}
+
+void mont_pow(mpz_t out, const mpz_t base, const mpz_t exponent, MontCtx *ctx) {
+    if (mpz_sgn(exponent) == 0) {
+        // x^0 = 1, which is R mod m taken out of Montgomery form
+        mpn_copyi(ctx->t, ctx->one, ctx->n);
+        mpn_zero(ctx->t + ctx->n, ctx->n + 1);
+        mont_redc(ctx->acc, ctx);
+        mpz_import(out, ctx->n, -1, sizeof(mp_limb_t), 0, GMP_NAIL_BITS, ctx->acc);
+        return;
+    }
+
+    MontRecoding rec;
+    mont_recode(&rec, exponent);
+    mont_pow_recoded(out, base, &rec, ctx);
+    mont_recoding_clear(&rec);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Montgomery arithmetic modulo a fixed odd modulus m, on GMP limbs.
+//
+// Numbers are kept as n-limb arrays in Montgomery form (x * R mod m, with R = 2^(n * limb bits)),
+// where a product is reduced by REDC instead of a division. Converting in and out costs one
+// multiplication each, so it only pays off across the many multiplications of an exponentiation.
+//
+typedef struct MontCtx {
+    mp_size_t n; // limbs in the modulus
+    mp_limb_t *m; // modulus
+    mp_limb_t minv; // -m^-1 mod 2^(limb bits)
+    mp_limb_t *r2; // R^2 mod m, to convert into Montgomery form
+    mp_limb_t *one; // R mod m, 1 in Montgomery form
+    mp_limb_t *t; // 2n + 1 limbs of product scratch
+    mp_limb_t *acc; // n limbs of accumulator scratch
+    mp_limb_t *table; // odd powers of the base for the sliding window, 2^(MONT_MAX_WINDOW-1) * n
+    mpz_t mod; // the modulus as an mpz_t
+    mpz_t base; // base reduced modulo m
+} MontCtx;
+
+//
+// An exponent recoded into sliding windows: before the i-th multiplication the accumulator is
+// squared squarings[i] times and then multiplied by table entry index[i] (the odd power
+// 2 * index[i] + 1 of the base). The first window loads its entry instead of multiplying, and tail
+// squarings follow the last window. Recoding an exponent once lets it be reused for many bases.
+//
+typedef struct MontRecoding {
+    int w; // window width
+    size_t count; // number of windows
+    uint32_t *squarings;
+    uint32_t *index;
+    uint32_t tail;
+} MontRecoding;
+
+#define MONT_MAX_WINDOW 6
+
+//
+// Sets up a Montgomery context for modulus m.
+//
+// Requires:
+//  m: odd modulus greater than 1
+//  ctx: cleared with mont_clear when no longer needed
+//
+void mont_init(MontCtx *ctx, const mpz_t m);
+
+//
+// Frees the memory used by a Montgomery context.
+//
+void mont_clear(MontCtx *ctx);
+
+//
+// Returns the sliding window width used for an exponent of the given number of bits.
+//
+int mont_window(uint64_t bits);
+
+//
+// Computes out = base^exponent mod m, where m is the modulus of ctx, with left-to-right
+// sliding-window exponentiation.
+//
+// Requires:
+//  exponent: non-negative
+//  ctx: initialized with mont_init
+//  all mpz_t arguments to be initialized; out may alias base
+//
+void mont_pow(mpz_t out, const mpz_t base, const mpz_t exponent, MontCtx *ctx);
+
+//
+// Recodes an exponent into sliding windows for mont_pow_recoded.
+//
+// Requires:
+//  exponent: positive
+//  rec: cleared with mont_recoding_clear when no longer needed
+//
+void mont_recode(MontRecoding *rec, const mpz_t exponent);
+
+//
+// Frees the memory used by a recoded exponent.
+//
+void mont_recoding_clear(MontRecoding *rec);
+
+//
+// Computes out = base^e mod m for the exponent e recoded in rec. Once out has grown to the size
+// of the modulus this does not allocate memory, so the same ctx and rec can be used for many
+// bases in a loop.
+//
+// Requires:
+//  rec: recoded with mont_recode
+//  ctx: initialized with mont_init
+//  all mpz_t arguments to be initialized; out may alias base
+//
+void mont_pow_recoded(mpz_t out, const mpz_t base, const MontRecoding *rec, MontCtx *ctx);
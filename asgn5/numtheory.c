@@ -2,14 +2,21 @@
 #include <gmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "numtheory.h"
+#include "montgomery.h"
+#include "pool.h"
+#include "profile.h"
 #include "randstate.h"
 #include "ss.h"
 
 // This function calculates the greatest common divisor of two mpz_t integers using the
 // Euclidean algorithm.
-void gcd(mpz_t g, const mpz_t a, const mpz_t b) {
+void gcd_euclid(mpz_t g, const mpz_t a, const mpz_t b) {
 
     // Initialize temporary variables
     mpz_t t, a_copy, b_copy;
@@ -33,7 +40,7 @@ void gcd(mpz_t g, const mpz_t a, const mpz_t b) {
     mpz_clears(t, a_copy, b_copy, NULL);
 }
 
-void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n) {
+void mod_inverse_euclid(mpz_t o, const mpz_t a, const mpz_t n) {
     mpz_t r, r1, t, t1, q, tmp;
 
     // Initialize variables
@@ -80,7 +87,32 @@ void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n) {
     mpz_clear(tmp);
 }
 
+// Computes the greatest common divisor g of a and b. GMP chooses the algorithm by operand size at
+// the limb level: binary GCD for single limbs, Lehmer's algorithm with double-limb quotient
+// simulation for mid-size operands, and a subquadratic half-GCD for large ones.
+void gcd(mpz_t g, const mpz_t a, const mpz_t b) {
+    mpz_gcd(g, a, b);
+}
+
+// Computes the inverse o of a modulo n, or 0 if there is none. The extended algorithm shares the
+// size-based choice of algorithms of gcd, with the cofactor kept by the same steps.
+void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n) {
+    if (mpz_invert(o, a, n) == 0) {
+        mpz_set_ui(o, 0);
+    }
+}
+
 void pow_mod(mpz_t out, const mpz_t base, const mpz_t exponent, const mpz_t modulus) {
+    // Every SS modulus is odd, so this is the usual path: Montgomery reduction and a sliding
+    // window instead of a division after every multiply
+    if (mpz_odd_p(modulus) && mpz_cmp_ui(modulus, 1) > 0) {
+        MontCtx ctx;
+        mont_init(&ctx, modulus);
+        mont_pow(out, base, exponent, &ctx);
+        mont_clear(&ctx);
+        return;
+    }
+
     mpz_t v, p, d;
     mpz_inits(v, p, d, NULL);
 
@@ -112,94 +144,465 @@ void pow_mod(mpz_t out, const mpz_t base, const mpz_t exponent, const mpz_t modu
     mpz_clears(v, p, d, NULL);
 }
 
-bool is_prime(const mpz_t n, uint64_t iters) {
-    mpz_t r, y, n_minus_one, two;
-    mpz_inits(r, y, n_minus_one, two, NULL);
-    mpz_set_ui(two, 2);
-
+// Decides n without Miller-Rabin if n < 4 or n is even, storing the answer in *prime. Returns
+// false for the odd n > 3 that need the test.
+static bool mr_trivial(const mpz_t n, bool *prime) {
     // ensure that n > 1
     if (mpz_cmp_ui(n, 1) <= 0) {
-        return false;
+        *prime = false;
+        return true;
     }
 
     // check if n is 2 or 3
     if (mpz_cmp_ui(n, 2) == 0 || mpz_cmp_ui(n, 3) == 0) {
+        *prime = true;
+        return true;
+    }
+
+    // any other even number is composite (and Montgomery arithmetic needs an odd modulus)
+    if (mpz_even_p(n)) {
+        *prime = false;
         return true;
     }
+    return false;
+}
+
+// What the Miller-Rabin rounds for an odd n > 3 share: n - 1 = 2^s * r with r odd, the range
+// witnesses are drawn from, and the Montgomery context for n, set up once for every round. The
+// context and a and y are scratch space, so every thread testing n needs its own MillerRabin.
+typedef struct MillerRabin {
+    mpz_t r, y, a, n_minus_one, two, range;
+    unsigned long int s;
+    MontCtx ctx;
+} MillerRabin;
+
+static void mr_init(MillerRabin *mr, const mpz_t n) {
+    mpz_inits(mr->r, mr->y, mr->a, mr->n_minus_one, mr->two, mr->range, NULL);
+    mpz_set_ui(mr->two, 2);
 
     // write n-1 = 2^s * r such that r is odd
-    mpz_sub_ui(n_minus_one, n, 1);
-    mpz_set(r, n_minus_one);
-    unsigned long int s = 0;
-    while (mpz_even_p(r)) {
-        mpz_divexact_ui(r, r, 2);
-        s++;
-    }
-
-    // do Miller-Rabin test with iters number of iterations
-    for (uint64_t i = 0; i < iters; i++) {
-        // choose random a in [2, n-2]
-        mpz_t a;
-        mpz_init(a);
-        mpz_urandomm(a, state, n_minus_one);
-        mpz_add_ui(a, a, 2);
-
-        // calculate y = a^r mod n
-        pow_mod(y, a, r, n);
-
-        if (mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, n_minus_one) == 0) {
+    mpz_sub_ui(mr->n_minus_one, n, 1);
+    mpz_set(mr->r, mr->n_minus_one);
+    mr->s = 0;
+    while (mpz_even_p(mr->r)) {
+        mpz_divexact_ui(mr->r, mr->r, 2);
+        mr->s++;
+    }
+
+    // witnesses are drawn from [2, n-2]
+    mpz_sub_ui(mr->range, n, 3);
+    mont_init(&mr->ctx, n);
+}
+
+static void mr_clear(MillerRabin *mr) {
+    mont_clear(&mr->ctx);
+    mpz_clears(mr->r, mr->y, mr->a, mr->n_minus_one, mr->two, mr->range, NULL);
+}
+
+// Runs one Miller-Rabin round with a witness drawn from rs, or from the global state if rs is
+// NULL. Returns true if the witness proves n composite.
+static bool mr_round(MillerRabin *mr, RandStream *rs) {
+    PROFILE_COUNT(PROFILE_MR_ROUNDS, 1);
+
+    // choose random a in [2, n-2]
+    if (rs != NULL) {
+        randstream_urandomm(mr->a, rs, mr->range);
+    } else {
+        mpz_urandomm(mr->a, state, mr->range);
+    }
+    mpz_add_ui(mr->a, mr->a, 2);
+
+    // calculate y = a^r mod n
+    mont_pow(mr->y, mr->a, mr->r, &mr->ctx);
+
+    if (mpz_cmp_ui(mr->y, 1) == 0 || mpz_cmp(mr->y, mr->n_minus_one) == 0) {
+        // inconclusive result, continue to next iteration
+        return false;
+    }
+
+    for (unsigned long int j = 1; j < mr->s; j++) {
+        mont_pow(mr->y, mr->y, mr->two, &mr->ctx);
+        if (mpz_cmp_ui(mr->y, 1) == 0) {
+            // n is composite, y = 1, and we've found a nontrivial square root of 1 modulo n
+            PROFILE_COUNT(PROFILE_MR_REJECTED, 1);
+            return true;
+        } else if (mpz_cmp(mr->y, mr->n_minus_one) == 0) {
             // inconclusive result, continue to next iteration
-            mpz_clear(a);
-            continue;
+            return false;
+        }
+    }
+
+    // n is composite, we've found a nontrivial square root of 1 modulo n
+    PROFILE_COUNT(PROFILE_MR_REJECTED, 1);
+    return true;
+}
+
+// Miller-Rabin test drawing witnesses from rs, or from the global state if rs is NULL. If best is
+// not NULL, n is candidate number index of a prime search, and the test gives up and returns false
+// as soon as a candidate before it has been proven prime.
+static bool miller_rabin(const mpz_t n, uint64_t iters, RandStream *rs,
+    const atomic_uint_fast64_t *best, uint64_t index) {
+    bool prime;
+    if (mr_trivial(n, &prime)) {
+        return prime;
+    }
+
+    MillerRabin mr;
+    mr_init(&mr, n);
+    prime = true;
+    for (uint64_t i = 0; i < iters && prime; i++) {
+        // another thread already found an earlier prime
+        if (best != NULL && atomic_load_explicit(best, memory_order_relaxed) < index) {
+            prime = false;
+            break;
+        }
+        prime = !mr_round(&mr, rs);
+    }
+    mr_clear(&mr);
+    return prime;
+}
+
+bool is_prime(const mpz_t n, uint64_t iters) {
+    return miller_rabin(n, iters, NULL, NULL, 0);
+}
+
+// Shared by every thread of a Miller-Rabin test whose rounds are spread over a pool.
+typedef struct MRJob {
+    mpz_srcptr n;
+    uint64_t iters;
+    RandStream *witnesses; // one witness stream per thread
+    atomic_bool composite; // set as soon as any witness proves n composite
+} MRJob;
+
+// Runs rounds id, id + threads, id + 2 * threads, ... of a test, stopping early once any thread
+// has proven n composite.
+static void mr_rounds(void *arg, int id, int threads) {
+    MRJob *job = (MRJob *) arg;
+    MillerRabin mr;
+    mr_init(&mr, job->n);
+    for (uint64_t i = id; i < job->iters; i += threads) {
+        if (atomic_load_explicit(&job->composite, memory_order_relaxed)) {
+            break;
         }
+        if (mr_round(&mr, &job->witnesses[id])) {
+            atomic_store_explicit(&job->composite, true, memory_order_relaxed);
+            break;
+        }
+    }
+    mr_clear(&mr);
+}
+
+// Miller-Rabin test with its rounds spread over the threads of pool, or run on the calling thread
+// if pool is NULL. witnesses holds one stream per thread.
+static bool miller_rabin_pool(const mpz_t n, uint64_t iters, Pool *pool, RandStream *witnesses) {
+    bool prime;
+    if (mr_trivial(n, &prime)) {
+        return prime;
+    }
+
+    MRJob job = { n, iters, witnesses, false };
+    if (pool != NULL) {
+        pool_run(pool, mr_rounds, &job);
+    } else {
+        mr_rounds(&job, 0, 1);
+    }
+    return !atomic_load(&job.composite);
+}
 
-        bool is_composite = true;
-        for (unsigned long int j = 1; j < s; j++) {
-            pow_mod(y, y, two, n);
-            if (mpz_cmp_ui(y, 1) == 0) {
-                // n is composite, y = 1, and we've found a nontrivial square root of 1 modulo n
-                mpz_clear(a);
-                return false;
-            } else if (mpz_cmp(y, n_minus_one) == 0) {
-                // inconclusive result, continue to next iteration
-                is_composite = false;
+bool is_prime_threads(const mpz_t n, uint64_t iters, int threads) {
+    if (threads <= 1) {
+        return is_prime(n, iters);
+    }
+    RandStream *witnesses = (RandStream *) malloc(threads * sizeof(RandStream));
+    if (witnesses == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for Miller-Rabin.\n");
+        exit(EXIT_FAILURE);
+    }
+    randstate_streams(witnesses, threads);
+    Pool *pool = pool_create(threads);
+    bool prime = miller_rabin_pool(n, iters, pool, witnesses);
+    pool_delete(pool);
+    free(witnesses);
+    return prime;
+}
+
+// Odd primes that candidates are sieved by before Miller-Rabin, and candidates per sieve window.
+#define SIEVE_PRIMES 2048
+#define SIEVE_WINDOW 4096
+
+// Candidates below this many bits could be one of the sieving primes, so they are not sieved.
+#define SIEVE_MIN_BITS 32
+
+static uint32_t small_primes[SIEVE_PRIMES];
+static pthread_once_t small_primes_once = PTHREAD_ONCE_INIT;
+
+// Fills small_primes with the first SIEVE_PRIMES odd primes by trial division.
+static void small_primes_init(void) {
+    int count = 0;
+    for (uint32_t n = 3; count < SIEVE_PRIMES; n += 2) {
+        bool prime = true;
+        for (int i = 0; i < count && small_primes[i] * small_primes[i] <= n; i++) {
+            if (n % small_primes[i] == 0) {
+                prime = false;
                 break;
             }
         }
+        if (prime) {
+            small_primes[count++] = n;
+        }
+    }
+}
 
-        if (is_composite) {
-            // n is composite, we've found a nontrivial square root of 1 modulo n
-            mpz_clear(a);
-            return false;
+//
+// Generates prime candidates of a fixed size. One random odd base is drawn, and the window of
+// candidates base, base + 2, ..., base + 2 * (SIEVE_WINDOW - 1) is sieved by the small primes, so
+// only candidates with no small factor reach Miller-Rabin. The residues of base modulo every
+// small prime are computed once per base and then updated as the window moves forward.
+//
+typedef struct PrimeSieve {
+    mpz_t base; // candidate at offset 0 of the window
+    uint64_t bits;
+    uint32_t residues[SIEVE_PRIMES]; // base mod small_primes[i]
+    bool composite[SIEVE_WINDOW]; // offset j stands for base + 2j
+    uint32_t next; // next offset of the window to look at
+} PrimeSieve;
+
+// Marks every candidate of the window that has a small prime factor.
+static void sieve_fill(PrimeSieve *sieve) {
+    memset(sieve->composite, 0, sizeof(sieve->composite));
+    for (int i = 0; i < SIEVE_PRIMES; i++) {
+        // base + 2j = 0 (mod p) where j = -base / 2 = (p - r) * (p + 1) / 2 (mod p)
+        uint64_t p = small_primes[i];
+        uint64_t j = (p - sieve->residues[i]) % p * ((p + 1) / 2) % p;
+        for (; j < SIEVE_WINDOW; j += p) {
+            sieve->composite[j] = true;
         }
+    }
+    sieve->next = 0;
+}
 
-        mpz_clear(a);
+// Draws a new random base of bits + 1 bits and sieves its window.
+static void sieve_reseed(PrimeSieve *sieve, RandStream *rs) {
+    randstream_urandomb(sieve->base, rs, sieve->bits);
+    mpz_setbit(sieve->base, sieve->bits);
+    mpz_setbit(sieve->base, 0);
+    for (int i = 0; i < SIEVE_PRIMES; i++) {
+        sieve->residues[i] = mpz_fdiv_ui(sieve->base, small_primes[i]);
     }
+    sieve_fill(sieve);
+}
 
-    // n is probably prime
-    return true;
+static PrimeSieve *sieve_create(uint64_t bits, RandStream *rs) {
+    pthread_once(&small_primes_once, small_primes_init);
+    PrimeSieve *sieve = (PrimeSieve *) malloc(sizeof(PrimeSieve));
+    if (sieve == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for prime search.\n");
+        exit(EXIT_FAILURE);
+    }
+    mpz_init(sieve->base);
+    sieve->bits = bits;
+    sieve_reseed(sieve, rs);
+    return sieve;
 }
 
-void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    // Initialize a temporary variable to hold the candidate prime
-    mpz_t candidate;
-    mpz_init(candidate);
+static void sieve_delete(PrimeSieve *sieve) {
+    mpz_clear(sieve->base);
+    free(sieve);
+}
 
-    // Generate a candidate prime number of the specified number of bits
-    do {
-        // Set the candidate prime number to a random integer of the specified number of bits
-        mpz_urandomb(candidate, state, bits);
+// Sets candidate to the next candidate with no small factor, moving the window forward when it
+// runs out, and starting over from a new random base if that would make the candidate too long.
+static void sieve_next(PrimeSieve *sieve, mpz_t candidate, RandStream *rs) {
+    while (true) {
+        while (sieve->next < SIEVE_WINDOW && sieve->composite[sieve->next]) {
+            PROFILE_COUNT(PROFILE_SIEVE_REJECTED, 1);
+            sieve->next++;
+        }
+        if (sieve->next < SIEVE_WINDOW) {
+            mpz_add_ui(candidate, sieve->base, 2 * sieve->next++);
+            if (mpz_sizeinbase(candidate, 2) == sieve->bits + 1) {
+                return;
+            }
+            sieve_reseed(sieve, rs);
+            continue;
+        }
 
-        // Make sure the candidate prime number has the specified number of bits
-        mpz_setbit(candidate, bits);
+        // Move to the next window: base += 2 * SIEVE_WINDOW, and the same for every residue
+        mpz_add_ui(sieve->base, sieve->base, 2 * SIEVE_WINDOW);
+        for (int i = 0; i < SIEVE_PRIMES; i++) {
+            sieve->residues[i] = (sieve->residues[i] + 2 * SIEVE_WINDOW) % small_primes[i];
+        }
+        sieve_fill(sieve);
+    }
+}
 
-        // Make sure the candidate prime number is odd
+//
+// One prime being searched for. Candidates come from one random stream in a fixed order and are
+// numbered as they are handed out; the prime found is the first candidate in that order that
+// passes Miller-Rabin, no matter how many threads test candidates or which of them finishes first.
+//
+typedef struct PrimeSearch {
+    mpz_ptr prime; // where the first prime is stored
+    uint64_t bits;
+    RandStream stream; // candidates are drawn from this stream
+    PrimeSieve *sieve; // NULL for candidates too small to sieve
+    uint64_t next; // index of the next candidate, guarded by lock
+    atomic_uint_fast64_t best; // index of the first candidate proven prime, UINT64_MAX until then
+    bool confirmed; // whether the prime found has passed the rest of the rounds
+    pthread_mutex_t lock;
+} PrimeSearch;
+
+// Shared by every thread of a prime search.
+typedef struct PrimeJob {
+    PrimeSearch *searches;
+    int count;
+    uint64_t iters; // rounds each candidate is screened with
+    RandStream *witnesses; // one Miller-Rabin witness stream per thread
+} PrimeJob;
+
+// Sets candidate to the next candidate of a search. The caller holds the lock of the search.
+static void candidate_next(PrimeSearch *search, mpz_t candidate) {
+    if (search->sieve != NULL) {
+        sieve_next(search->sieve, candidate, &search->stream);
+    } else {
+        randstream_urandomb(candidate, &search->stream, search->bits);
+        mpz_setbit(candidate, search->bits);
         mpz_setbit(candidate, 0);
-    } while (!is_prime(candidate, iters));
+    }
+}
 
-    // Copy the candidate prime number into the output variable
-    mpz_set(p, candidate);
+// Tests candidates of the searches, starting with search id % count so that the threads are
+// spread over all of them. Once a candidate of a search is proven prime, later candidates are no
+// longer handed out and the tests of later candidates still running give up, while earlier ones
+// are finished in case one of them is prime too.
+static void prime_search(void *arg, int id, int threads) {
+    (void) threads;
+    PrimeJob *job = (PrimeJob *) arg;
+    mpz_t candidate;
+    mpz_init(candidate);
+
+    for (int k = 0; k < job->count; k++) {
+        PrimeSearch *search = &job->searches[(id + k) % job->count];
+        while (true) {
+            pthread_mutex_lock(&search->lock);
+            if (search->next >= atomic_load(&search->best)) {
+                pthread_mutex_unlock(&search->lock);
+                break;
+            }
+            uint64_t index = search->next++;
+            candidate_next(search, candidate);
+            pthread_mutex_unlock(&search->lock);
+
+            if (miller_rabin(
+                    candidate, job->iters, &job->witnesses[id], &search->best, index)) {
+                pthread_mutex_lock(&search->lock);
+                if (index < atomic_load(&search->best)) {
+                    mpz_set(search->prime, candidate);
+                    atomic_store(&search->best, index);
+                }
+                pthread_mutex_unlock(&search->lock);
+            }
+        }
+    }
 
-    // Clear the temporary variable
     mpz_clear(candidate);
 }
+
+// Finds the primes of count searches on threads threads. streams holds count streams for the
+// candidates of each search, followed by one Miller-Rabin witness stream per thread.
+static void prime_search_run(
+    PrimeSearch *searches, int count, uint64_t iters, int threads, RandStream *streams) {
+    for (int i = 0; i < count; i++) {
+        PrimeSearch *search = &searches[i];
+        search->stream = streams[i];
+        search->sieve
+            = search->bits >= SIEVE_MIN_BITS ? sieve_create(search->bits, &search->stream) : NULL;
+        search->next = 0;
+        atomic_init(&search->best, UINT64_MAX);
+        search->confirmed = false;
+        pthread_mutex_init(&search->lock, NULL);
+    }
+
+    // Nearly every candidate that survives the sieve is proven composite by its first round, so
+    // candidates are screened with one round, and the other iters - 1 rounds are spent on the
+    // prime found only, spread over every thread. If it fails them, its search carries on. A
+    // single thread needs no pool.
+    Pool *pool = threads > 1 ? pool_create(threads) : NULL;
+    PrimeJob job = { searches, count, iters < 1 ? iters : 1, streams + count };
+    bool pending = true;
+    while (pending) {
+        if (pool != NULL) {
+            pool_run(pool, prime_search, &job);
+        } else {
+            prime_search(&job, 0, 1);
+        }
+
+        pending = false;
+        for (int i = 0; i < count; i++) {
+            PrimeSearch *search = &searches[i];
+            if (search->confirmed) {
+                continue;
+            }
+            search->confirmed = iters <= 1
+                                || miller_rabin_pool(search->prime, iters - 1, pool, job.witnesses);
+            if (!search->confirmed) {
+                atomic_store(&search->best, UINT64_MAX);
+                pending = true;
+            }
+        }
+    }
+    if (pool != NULL) {
+        pool_delete(pool);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (searches[i].sieve != NULL) {
+            sieve_delete(searches[i].sieve);
+        }
+        pthread_mutex_destroy(&searches[i].lock);
+    }
+}
+
+// Sets up count searches for primes[i] of bits[i] + 1 bits and runs them on threads threads,
+// with streams split from rs, or from the random state if rs is NULL.
+static void make_primes(mpz_t primes[], const uint64_t bits[], int count, uint64_t iters,
+    int threads, RandStream *rs) {
+    threads = threads < 1 ? 1 : threads;
+    PrimeSearch *searches = (PrimeSearch *) malloc(count * sizeof(PrimeSearch));
+    RandStream *streams = (RandStream *) malloc((count + threads) * sizeof(RandStream));
+    if (searches == NULL || streams == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for prime search.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        searches[i].prime = primes[i];
+        searches[i].bits = bits[i];
+    }
+
+    // The first count streams give the candidates, so the primes found only depend on the seed;
+    // the rest give each thread its own witnesses
+    if (rs != NULL) {
+        randstream_split(rs, streams, count + threads);
+    } else {
+        randstate_streams(streams, count + threads);
+    }
+    prime_search_run(searches, count, iters, threads, streams);
+    free(streams);
+    free(searches);
+}
+
+void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
+    // Only candidates without a small factor are tested with Miller-Rabin
+    mpz_t *primes = (mpz_t *) p;
+    make_primes(primes, &bits, 1, iters, 1, NULL);
+}
+
+void make_primes_threads(
+    mpz_t primes[], const uint64_t bits[], int count, uint64_t iters, int threads) {
+    make_primes(primes, bits, count, iters, threads, NULL);
+}
+
+void make_primes_stream(
+    mpz_t primes[], const uint64_t bits[], int count, uint64_t iters, RandStream *rs) {
+    make_primes(primes, bits, count, iters, 1, rs);
+}
@@ -5,12 +5,48 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "randstate.h"
+
 void gcd(mpz_t g, const mpz_t a, const mpz_t b);
 
 void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n);
 
+//
+// The original Euclidean gcd and mod_inverse, with one multi-precision division per step. Kept as
+// the reference for bench; gcd and mod_inverse give the same results.
+//
+void gcd_euclid(mpz_t g, const mpz_t a, const mpz_t b);
+
+void mod_inverse_euclid(mpz_t o, const mpz_t a, const mpz_t n);
+
 void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
 
 bool is_prime(const mpz_t n, uint64_t iters);
 
+//
+// Miller-Rabin test like is_prime with its iters rounds spread over threads threads. Every thread
+// draws witnesses from its own random stream, and all of them stop as soon as one witness proves
+// n composite, so a prime takes about iters / threads rounds of time to confirm.
+//
+bool is_prime_threads(const mpz_t n, uint64_t iters, int threads);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+//
+// Finds count primes at once on threads threads: primes[i] gets a random prime of bits[i] + 1
+// bits, like make_prime. The candidates for each prime come from their own random stream and the
+// first of them to pass Miller-Rabin is the prime found, so the result only depends on the seed of
+// the random state, not on the number of threads. Threads test candidates of every search at the
+// same time, and give up on a candidate as soon as an earlier one has been proven prime. Candidates
+// are screened with one Miller-Rabin round each, and the other iters - 1 rounds of the prime found
+// are run on all threads at once, as by is_prime_threads.
+//
+void make_primes_threads(
+    mpz_t primes[], const uint64_t bits[], int count, uint64_t iters, int threads);
+
+//
+// Finds count primes on the calling thread like make_primes_threads, drawing every random number
+// from rs instead of the random state, so several threads can each search with their own stream.
+//
+void make_primes_stream(
+    mpz_t primes[], const uint64_t bits[], int count, uint64_t iters, RandStream *rs);
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+struct Pool {
+    int threads;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start; // signalled when a new task is posted
+    pthread_cond_t done; // signalled when the last worker finishes a task
+    PoolTask task;
+    void *arg;
+    uint64_t generation; // incremented for every task posted
+    int running; // workers still running the current task
+    bool stop;
+};
+
+typedef struct Worker {
+    Pool *pool;
+    int id;
+} Worker;
+
+// Waits for each new task and runs it, until the pool is deleted.
+static void *pool_worker(void *arg) {
+    Worker *worker = (Worker *) arg;
+    Pool *pool = worker->pool;
+    int id = worker->id;
+    free(worker);
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        PoolTask task = pool->task;
+        void *task_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(task_arg, id, pool->threads);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+Pool *pool_create(int threads) {
+    Pool *pool = (Pool *) calloc(1, sizeof(Pool));
+    if (pool == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for thread pool.\n");
+        exit(EXIT_FAILURE);
+    }
+    pool->threads = threads < 1 ? 1 : threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // The calling thread is thread 0, so only threads - 1 workers are started
+    pool->workers = (pthread_t *) calloc(pool->threads, sizeof(pthread_t));
+    for (int i = 1; i < pool->threads; i++) {
+        Worker *worker = (Worker *) malloc(sizeof(Worker));
+        if (pool->workers == NULL || worker == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for thread pool.\n");
+            exit(EXIT_FAILURE);
+        }
+        worker->pool = pool;
+        worker->id = i;
+        if (pthread_create(&pool->workers[i], NULL, pool_worker, worker) != 0) {
+            fprintf(stderr, "Error: Unable to create worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+void pool_run(Pool *pool, PoolTask task, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->running = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(arg, 0, pool->threads);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_threads(const Pool *pool) {
+    return pool->threads;
+}
+
+void pool_delete(Pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// A fork-join pool of worker threads. pool_run runs one task on every thread of the pool at once,
+// including the calling thread, and returns when all of them have finished. The threads are
+// created once, so a pool can run many small tasks, such as one batch of blocks each.
+//
+typedef struct Pool Pool;
+
+//
+// A task run by every thread of a pool.
+//
+// arg: the argument given to pool_run
+// id: index of the thread running the task, from 0 to threads - 1; the calling thread is 0
+// threads: number of threads in the pool
+//
+typedef void (*PoolTask)(void *arg, int id, int threads);
+
+//
+// Creates a pool of threads threads, counting the calling thread. A pool of 1 runs tasks on the
+// calling thread only. Exits if the threads cannot be created.
+//
+Pool *pool_create(int threads);
+
+//
+// Runs task(arg, id, threads) on every thread of the pool and waits for all of them to finish.
+//
+void pool_run(Pool *pool, PoolTask task, void *arg);
+
+//
+// Returns the number of threads in the pool.
+//
+int pool_threads(const Pool *pool);
+
+//
+// Stops the threads of the pool and frees it.
+//
+void pool_delete(Pool *pool);
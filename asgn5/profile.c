@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "profile.h"
+
+static const char *const profile_names[PROFILE_COUNTERS] = {
+    "modmul",
+    "sqr",
+    "redc",
+    "modexp",
+    "mr_rounds",
+    "sieve_rejected",
+    "mr_rejected",
+};
+
+#ifdef SS_PROFILE
+
+_Thread_local Profile *profile_local = NULL;
+
+// Every thread's counters, newest first. Entries are never freed, so the counters of threads that
+// have exited are still reported.
+static Profile *profile_list = NULL;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Profile *profile_register(void) {
+    Profile *profile = (Profile *) calloc(1, sizeof(Profile));
+    if (profile == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for profile.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&profile_lock);
+    profile->next = profile_list;
+    profile_list = profile;
+    pthread_mutex_unlock(&profile_lock);
+    profile_local = profile;
+    return profile;
+}
+
+uint64_t profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_modexp(uint64_t start) {
+    uint64_t ns = profile_now() - start;
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && ns >> (bucket + 1) != 0) {
+        bucket++;
+    }
+    Profile *profile = profile_local != NULL ? profile_local : profile_register();
+    profile->counts[PROFILE_MODEXP]++;
+    profile->latency[bucket]++;
+}
+
+#endif
+
+bool profile_enabled(void) {
+#ifdef SS_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void profile_report(FILE *out) {
+#ifdef SS_PROFILE
+    Profile total = { { 0 }, { 0 }, NULL };
+    pthread_mutex_lock(&profile_lock);
+    for (const Profile *profile = profile_list; profile != NULL; profile = profile->next) {
+        for (int i = 0; i < PROFILE_COUNTERS; i++) {
+            total.counts[i] += profile->counts[i];
+        }
+        for (int i = 0; i < PROFILE_BUCKETS; i++) {
+            total.latency[i] += profile->latency[i];
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    for (int i = 0; i < PROFILE_COUNTERS; i++) {
+        fprintf(out, "%s = %" PRIu64 "\n", profile_names[i], total.counts[i]);
+    }
+    if (total.counts[PROFILE_MODEXP] > 0) {
+        fprintf(out, "modexp latency:\n");
+        for (int i = 0; i < PROFILE_BUCKETS; i++) {
+            if (total.latency[i] > 0) {
+                fprintf(out, "  %10.3f us - %10.3f us: %" PRIu64 "\n", (double) (1ULL << i) / 1e3,
+                    (double) (2ULL << i) / 1e3, total.latency[i]);
+            }
+        }
+    }
+#else
+    (void) out;
+    (void) profile_names;
+#endif
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Operation counters for profiling builds (make PROFILE=1, which defines SS_PROFILE). In other
+// builds the PROFILE_ macros expand to nothing, so the arithmetic pays nothing for them. Every
+// thread counts into its own Profile, and profile_report adds them up, so counting takes no locks.
+//
+typedef enum ProfileCounter {
+    PROFILE_MODMUL, // Montgomery multiplications of two different numbers
+    PROFILE_SQR, // Montgomery squarings
+    PROFILE_REDC, // Montgomery reductions, including the ones interleaved with a multiplication
+    PROFILE_MODEXP, // modular exponentiations
+    PROFILE_MR_ROUNDS, // Miller-Rabin rounds, one per witness tried
+    PROFILE_SIEVE_REJECTED, // prime candidates rejected by the small prime sieve
+    PROFILE_MR_REJECTED, // prime candidates proven composite by Miller-Rabin
+    PROFILE_COUNTERS
+} ProfileCounter;
+
+#define PROFILE_BUCKETS 40 // Modexp latency buckets: bucket i holds times in [2^i, 2^(i+1)) ns.
+
+typedef struct Profile {
+    uint64_t counts[PROFILE_COUNTERS];
+    uint64_t latency[PROFILE_BUCKETS];
+    struct Profile *next; // next thread's counters
+} Profile;
+
+#ifdef SS_PROFILE
+
+extern _Thread_local Profile *profile_local;
+
+//
+// Allocates the counters of the calling thread and links them into the list that
+// profile_report reads.
+//
+Profile *profile_register(void);
+
+//
+// Monotonic time in nanoseconds.
+//
+uint64_t profile_now(void);
+
+//
+// Adds the time since start, from profile_now, to the modexp latency histogram.
+//
+void profile_modexp(uint64_t start);
+
+static inline void profile_count(ProfileCounter counter, uint64_t count) {
+    Profile *profile = profile_local != NULL ? profile_local : profile_register();
+    profile->counts[counter] += count;
+}
+
+#define PROFILE_COUNT(counter, count) profile_count(counter, count)
+#define PROFILE_START(start)          uint64_t start = profile_now()
+#define PROFILE_MODEXP(start)         profile_modexp(start)
+
+#else
+
+#define PROFILE_COUNT(counter, count) ((void) 0)
+#define PROFILE_START(start)          ((void) 0)
+#define PROFILE_MODEXP(start)         ((void) 0)
+
+#endif
+
+//
+// Returns whether this is a profiling build.
+//
+bool profile_enabled(void);
+
+//
+// Prints the counters of every thread added up, and the modexp latency histogram, to out. Prints
+// nothing unless this is a profiling build. Threads still counting may be missed by a few counts.
+//
+void profile_report(FILE *out);
@@ -2,12 +2,48 @@
 #include <gmp.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "randstate.h"
 
 // global random state variable
 gmp_randstate_t state;
 
+// main stream, from which every other stream is derived
+static RandStream root;
+
+#define ROTL(x, k) (((x) << (k)) | ((x) >> (64 - (k))))
+
+// splitmix64, used to expand the seed into the 256 bits of the main stream
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// Advances a stream as if randstream_next had been called 2^128 times (jump) or 2^192 times (long
+// jump), depending on the polynomial given.
+static void randstream_jump(RandStream *stream, const uint64_t poly[4]) {
+    uint64_t s[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (poly[i] & ((uint64_t) 1 << b)) {
+                for (int j = 0; j < 4; j++) {
+                    s[j] ^= stream->s[j];
+                }
+            }
+            randstream_next(stream);
+        }
+    }
+    memcpy(stream->s, s, sizeof(s));
+}
+
+static const uint64_t JUMP[4]
+    = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+static const uint64_t LONG_JUMP[4]
+    = { 0x76e15d3efefdcbbf, 0xc5004e441c522fb3, 0x77710069854ee241, 0x39109bb02acbe635 };
+
 void randstate_init(uint64_t seed) {
     // initialize the global random state with Mersenne Twister algorithm
     gmp_randinit_mt(state);
@@ -15,11 +51,79 @@ void randstate_init(uint64_t seed) {
     // seed the random state with the given seed
     gmp_randseed_ui(state, seed);
 
-    // set the seed for the m random number generator
-    srandom(seed);
+    // seed the main stream with the given seed
+    uint64_t x = seed;
+    for (int i = 0; i < 4; i++) {
+        root.s[i] = splitmix64(&x);
+    }
 }
 
 void randstate_clear(void) {
     // clear and free memory used by the random state
     gmp_randclear(state);
 }
+
+uint64_t randstate_next(void) {
+    return randstream_next(&root);
+}
+
+void randstate_streams(RandStream streams[], int count) {
+    // stream i starts i + 1 long jumps after the main stream, which then moves past all of them,
+    // so each stream has 2^192 numbers to itself and room for 2^64 streams split from it
+    for (int i = 0; i < count; i++) {
+        randstream_jump(&root, LONG_JUMP);
+        streams[i] = root;
+    }
+    randstream_jump(&root, LONG_JUMP);
+}
+
+void randstream_split(RandStream *stream, RandStream streams[], int count) {
+    // stream i starts i + 1 jumps after the parent stream, which then moves past all of them. Only
+    // short jumps are taken, so the new streams stay within the 2^192 numbers of the parent and
+    // never reach a sibling of it from randstate_streams.
+    for (int i = 0; i < count; i++) {
+        randstream_jump(stream, JUMP);
+        streams[i] = *stream;
+    }
+    randstream_jump(stream, JUMP);
+}
+
+uint64_t randstream_next(RandStream *stream) {
+    uint64_t *s = stream->s;
+    uint64_t result = ROTL(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = ROTL(s[3], 45);
+    return result;
+}
+
+void randstream_urandomb(mpz_t r, RandStream *stream, uint64_t bits) {
+    if (bits == 0) {
+        mpz_set_ui(r, 0);
+        return;
+    }
+
+    // fill the limbs of r directly, and drop the bits above the top one
+    mp_size_t n = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+    mp_limb_t *limbs = mpz_limbs_write(r, n);
+    for (mp_size_t i = 0; i < n; i++) {
+        limbs[i] = (mp_limb_t) randstream_next(stream);
+    }
+    if (bits % GMP_NUMB_BITS != 0) {
+        limbs[n - 1] &= ((mp_limb_t) 1 << (bits % GMP_NUMB_BITS)) - 1;
+    }
+    mpz_limbs_finish(r, n);
+}
+
+void randstream_urandomm(mpz_t r, RandStream *stream, const mpz_t n) {
+    // draw numbers with as many bits as n until one is less than n, which takes 2 tries at most on
+    // average
+    size_t bits = mpz_sizeinbase(n, 2);
+    do {
+        randstream_urandomb(r, stream, bits);
+    } while (mpz_cmp(r, n) >= 0);
+}
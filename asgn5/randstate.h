@@ -6,6 +6,17 @@
 
 extern gmp_randstate_t state;
 
+//
+// An independent stream of random numbers (xoshiro256**). Streams are derived from the seed given
+// to randstate_init: streams from randstate_streams are 2^192 numbers apart, and streams split from
+// one of them are 2^128 numbers apart within its span, so streams never overlap. A stream is only
+// ever used by one thread, so threads draw random numbers without locks, and every stream is the
+// same from run to run for a given seed.
+//
+typedef struct RandStream {
+    uint64_t s[4];
+} RandStream;
+
 //
 // Initializes the random state needed for SS key generation operations.
 // Must be called before any key generation or number theory operations are used.
@@ -19,3 +30,45 @@ void randstate_init(uint64_t seed);
 // Must be called after all key generation or number theory operations are used.
 //
 void randstate_clear(void);
+
+//
+// Returns the next 64 random bits of the main stream of the random state.
+// Must only be called from one thread at a time.
+//
+uint64_t randstate_next(void);
+
+//
+// Derives count new streams from the random state. Every call gives different streams, which do
+// not overlap each other or any stream derived before.
+// Must only be called from one thread at a time; the streams can then be handed to other threads.
+//
+// streams: array of count streams to fill.
+// count: the number of streams to derive.
+//
+void randstate_streams(RandStream streams[], int count);
+
+//
+// Derives count new streams from a stream, like randstate_streams does from the random state. The
+// new streams do not overlap each other, the rest of the parent stream, or any other stream from
+// randstate_streams. Streams from randstream_split must not be split again.
+//
+// stream: the parent stream, which is advanced past the new streams.
+// streams: array of count streams to fill.
+// count: the number of streams to derive.
+//
+void randstream_split(RandStream *stream, RandStream streams[], int count);
+
+//
+// Returns the next 64 random bits of a stream.
+//
+uint64_t randstream_next(RandStream *stream);
+
+//
+// Sets r to a uniformly random integer in [0, 2^bits - 1] drawn from a stream.
+//
+void randstream_urandomb(mpz_t r, RandStream *stream, uint64_t bits);
+
+//
+// Sets r to a uniformly random integer in [0, n - 1] drawn from a stream. n must be positive.
+//
+void randstream_urandomm(mpz_t r, RandStream *stream, const mpz_t n);
@@ -6,10 +6,43 @@
 #include <string.h>
 #include <math.h>
 
+#include "chacha.h"
 #include "numtheory.h"
+#include "pool.h"
 #include "randstate.h"
 #include "ss.h"
 
+// Blocks per thread in each batch handed to a thread pool.
+#define BATCH_PER_THREAD 16
+
+// Bytes of data read and encrypted at a time in hybrid mode.
+#define HYBRID_CHUNK (1 << 16)
+
+// A batch of blocks shared by the threads of a pool. Thread i handles blocks i, i + threads, ...
+typedef struct SSBatch {
+    size_t count; // blocks in this batch
+    mpz_t *in; // blocks to process
+    mpz_t *out; // results, in the same order
+    SSEncCtx *enc; // one encryption context per thread
+    SSDecCtx *dec; // one decryption context per thread
+} SSBatch;
+
+// Stores the low size bytes of value at bytes, least significant first.
+static void ss_put_le(uint8_t *bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// Loads a size-byte little-endian value from bytes.
+static uint64_t ss_get_le(const uint8_t *bytes, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
 //
 // Generates the components for a new SS key.
 //
@@ -24,30 +57,52 @@
 //  all mpz_t arguments to be initialized
 //
 void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
-    // compute number of bits for p
-    uint64_t p_bits = (nbits / 5) + random() % (nbits / 5);
+    ss_make_pub_threads(p, q, n, nbits, iters, 1);
+}
 
-    // generate p using Miller-Rabin primality test
-    make_prime(p, p_bits, iters);
+//
+// Generates the components for a new SS key, searching for p and q at the same time on threads
+// threads. The key only depends on the seed of the random state, not on the number of threads.
+//
+void ss_make_pub_threads(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters, int threads) {
+    // compute number of bits for p and q
+    uint64_t p_bits = (nbits / 5) + randstate_next() % (nbits / 5);
+    uint64_t q_bits = nbits - 2 * p_bits;
 
-    // compute q = n / (p^2)
-    mpz_t p_square;
-    mpz_init(p_square);
-    mpz_mul(p_square, p, p);
-    mpz_div(q, n, p_square);
+    // p and q are found concurrently, from their own random streams
+    mpz_t primes[2];
+    uint64_t bits[2] = { p_bits, q_bits };
+    mpz_inits(primes[0], primes[1], NULL);
+    make_primes_threads(primes, bits, 2, iters, threads);
+    mpz_swap(p, primes[0]);
+    mpz_swap(q, primes[1]);
+    mpz_clears(primes[0], primes[1], NULL);
 
-    // compute the number of bits for q
+    // compute n = p^2 * q
+    mpz_mul(n, p, p);
+    mpz_mul(n, n, q);
+}
+
+//
+// Generates the components for a new SS key on the calling thread, drawing every random number
+// from rs.
+//
+void ss_make_pub_stream(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters, RandStream *rs) {
+    // compute number of bits for p and q
+    uint64_t p_bits = (nbits / 5) + randstream_next(rs) % (nbits / 5);
     uint64_t q_bits = nbits - 2 * p_bits;
 
-    // generate a prime number for q using Miller-Rabin primality test
-    make_prime(q, q_bits, iters);
+    mpz_t primes[2];
+    uint64_t bits[2] = { p_bits, q_bits };
+    mpz_inits(primes[0], primes[1], NULL);
+    make_primes_stream(primes, bits, 2, iters, rs);
+    mpz_swap(p, primes[0]);
+    mpz_swap(q, primes[1]);
+    mpz_clears(primes[0], primes[1], NULL);
 
     // compute n = p^2 * q
     mpz_mul(n, p, p);
     mpz_mul(n, n, q);
-
-    // clear temporary variables
-    mpz_clear(p_square);
 }
 
 //
@@ -136,29 +191,28 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile) {
 //  all mpz_t arguments to be initialized
 //
 void ss_read_pub(mpz_t n, char username[], FILE *pbfile) {
-    char *n_hexstring = NULL;
-    size_t n_hexstring_size = 0;
+    char *line = NULL;
+    size_t line_size = 0;
 
     // Read the hexstring representation of n from the input stream
-    ssize_t read = getline(&n_hexstring, &n_hexstring_size, pbfile);
-    if (read == -1) {
+    if (getline(&line, &line_size, pbfile) == -1 || mpz_set_str(n, line, 16) != 0) {
         fprintf(stderr, "Error reading public key from input stream\n");
         exit(1);
     }
-    mpz_set_str(n, n_hexstring, 16);
 
-    // Read the username from the input stream
-    read = getline(&username, &n_hexstring_size, pbfile);
-    if (read == -1) {
+    // Read the username from the input stream, into getline's buffer first since a name can be
+    // longer than the caller's array
+    if (getline(&line, &line_size, pbfile) == -1) {
         fprintf(stderr, "Error reading username from input stream\n");
         exit(1);
     }
 
     // Remove trailing newline character from username
-    username[strcspn(username, "\n")] = '\0';
+    line[strcspn(line, "\n")] = '\0';
+    snprintf(username, SS_USERNAME_SIZE, "%s", line);
 
-    // Free memory allocated by getline for the n_hexstring buffer
-    free(n_hexstring);
+    // Free memory allocated by getline for the line buffer
+    free(line);
 }
 
 //
@@ -173,11 +227,17 @@ void ss_read_pub(mpz_t n, char username[], FILE *pbfile) {
 //  all mpz_t arguments to be initialized
 //
 void ss_read_priv(mpz_t pq, mpz_t d, FILE *pvfile) {
-    char buf[256];
-    fgets(buf, sizeof(buf), pvfile);
-    mpz_set_str(pq, buf, 16);
-    fgets(buf, sizeof(buf), pvfile);
-    mpz_set_str(d, buf, 16);
+    // Keys of 2048 bits and up do not fit a fixed-size line buffer
+    mpz_ptr fields[] = { pq, d };
+    char *line = NULL;
+    size_t line_size = 0;
+    for (int i = 0; i < 2; i++) {
+        if (getline(&line, &line_size, pvfile) == -1 || mpz_set_str(fields[i], line, 16) != 0) {
+            fprintf(stderr, "Error reading private key from input stream\n");
+            exit(1);
+        }
+    }
+    free(line);
 }
 
 //
@@ -195,6 +255,54 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
     pow_mod(c, m, n, n);
 }
 
+//
+// Prepares an encryption context for public key n.
+//
+// Requires:
+//  n: public exponent/modulus
+//  ctx: cleared with ss_enc_clear when no longer needed
+//
+void ss_enc_init(SSEncCtx *ctx, const mpz_t n) {
+    mont_init(&ctx->mont, n);
+    mont_recode(&ctx->rec, n);
+}
+
+//
+// Frees the memory used by an encryption context.
+//
+void ss_enc_clear(SSEncCtx *ctx) {
+    mont_clear(&ctx->mont);
+    mont_recoding_clear(&ctx->rec);
+}
+
+//
+// Encrypt number m into number c with a prepared context. Gives the same result as ss_encrypt.
+//
+// Provides:
+//  c: encrypted integer
+//
+// Requires:
+//  m: original integer
+//  ctx: initialized with ss_enc_init
+//  all mpz_t arguments to be initialized
+//
+void ss_encrypt_ctx(mpz_t c, const mpz_t m, SSEncCtx *ctx) {
+    mont_pow_recoded(c, m, &ctx->rec, &ctx->mont);
+}
+
+//
+// Bytes in a plaintext block for the public modulus n, counting the 0xFF prefix.
+//
+// Requires:
+//  n: public exponent and modulus
+//
+size_t ss_block_size(const mpz_t n) {
+    // A block of k bytes is less than 2^(8k), and n >= 2^(log2n - 1), so 8k <= (log2n - 1) / 2
+    // keeps it below sqrt(n) < pq
+    size_t log2n = mpz_sizeinbase(n, 2);
+    return log2n > 0 ? (log2n - 1) / 16 : 0;
+}
+
 //
 // Encrypt an arbitrary file
 //
@@ -207,27 +315,35 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
 //  n: public exponent and modulus
 //
 void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
-    // Calculate block size k
-    int b = 256; // Set the number of bits per byte
-    int log2p = mpz_sizeinbase(n, 2);
-    int k = ((b * (log2p - 1)) / 8);
+    // Calculate block size k, which must leave room for a byte of data after the 0xFF byte
+    size_t k = ss_block_size(n);
+    if (k < 2) {
+        fprintf(stderr, "Error: public key is too small to encrypt with.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Allocate memory for block
+    // Allocate memory for block, and for the largest hexstring a ciphertext can need
     uint8_t *block = (uint8_t *) malloc(k * sizeof(uint8_t));
-    if (block == NULL) {
+    char *hexstr = (char *) malloc(mpz_sizeinbase(n, 16) + 2);
+    if (block == NULL || hexstr == NULL) {
         fprintf(stderr, "Error: Unable to allocate memory for block.\n");
         exit(EXIT_FAILURE);
     }
 
+    // Everything the loop needs is set up once per key
+    SSEncCtx ctx;
+    ss_enc_init(&ctx, n);
+    mpz_t m, c;
+    mpz_init2(m, k * 8);
+    mpz_init2(c, mpz_sizeinbase(n, 2));
+
     // Encrypt data in blocks
     size_t j;
     while ((j = fread(block + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
         // Set first byte of block to 0xFF
         block[0] = 0xFF;
 
-        // Initialize and set m to the input message
-        mpz_t m;
-        mpz_init(m);
+        // Set m to the input message
         mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, block);
 
         // Check if block is equal to 0 or 1
@@ -236,21 +352,206 @@ void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
             exit(EXIT_FAILURE);
         }
 
-        // Encrypt block with ss_encrypt
-        mpz_t c;
-        mpz_init(c);
-        ss_encrypt(c, m, n);
+        // Encrypt block with the precomputed context
+        ss_encrypt_ctx(c, m, &ctx);
 
         // Write encrypted block to outfile as hexstring
-        char *hexstr = mpz_get_str(NULL, 16, c);
-        fprintf(outfile, "%s\n", hexstr);
-        free(hexstr);
+        mpz_get_str(hexstr, 16, c);
+        fputs(hexstr, outfile);
+        fputc('\n', outfile);
+    }
+
+    mpz_clears(m, c, NULL);
+    ss_enc_clear(&ctx);
+    free(hexstr);
+    free(block);
+}
+
+//
+// Write a binary ciphertext header.
+//
+// Requires:
+//  outfile: open and writable file stream
+//  header: header to write
+//
+void ss_write_header(FILE *outfile, const SSHeader *header) {
+    uint8_t bytes[SS_HEADER_SIZE] = { 0 };
+    memcpy(bytes, SS_MAGIC, 4);
+    ss_put_le(bytes + 4, header->version, 2);
+    ss_put_le(bytes + 8, header->width, 4);
+    ss_put_le(bytes + 12, header->block_bytes, 4);
+    ss_put_le(bytes + 16, header->blocks, 8);
+    fwrite(bytes, 1, SS_HEADER_SIZE, outfile);
+}
+
+//
+// Read a binary ciphertext header.
+//
+// Provides:
+//  header: header read from infile
+//
+// Requires:
+//  infile: open and readable file stream, positioned at the header
+//
+// Returns false if infile does not start with a binary ciphertext header of a known version.
+//
+bool ss_read_header(FILE *infile, SSHeader *header) {
+    uint8_t bytes[SS_HEADER_SIZE];
+    return fread(bytes, 1, SS_HEADER_SIZE, infile) == SS_HEADER_SIZE
+           && ss_parse_header(bytes, header);
+}
+
+//
+// Parse a binary ciphertext header from memory.
+//
+// Provides:
+//  header: header held in bytes
+//
+// Requires:
+//  bytes: the first SS_HEADER_SIZE bytes of a binary ciphertext file
+//
+// Returns false if bytes are not a binary ciphertext header of a known version.
+//
+bool ss_parse_header(const uint8_t *bytes, SSHeader *header) {
+    if (memcmp(bytes, SS_MAGIC, 4) != 0) {
+        return false;
+    }
+    header->version = ss_get_le(bytes + 4, 2);
+    header->width = ss_get_le(bytes + 8, 4);
+    header->block_bytes = ss_get_le(bytes + 12, 4);
+    header->blocks = ss_get_le(bytes + 16, 8);
+    return header->version == SS_VERSION && header->width > 0;
+}
+
+// Encrypts this thread's share of a batch with its own context.
+static void ss_encrypt_batch(void *arg, int id, int threads) {
+    SSBatch *batch = (SSBatch *) arg;
+    for (size_t i = id; i < batch->count; i += threads) {
+        ss_encrypt_ctx(batch->out[i], batch->in[i], &batch->enc[id]);
+    }
+}
+
+//
+// Encrypt an arbitrary file on several threads. Blocks are read in batches on the calling thread,
+// encrypted on every thread of the pool, and written in their original order, so the hexstring
+// output is identical to ss_encrypt_file.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  threads: number of threads to encrypt on, counting the calling thread
+//  binary: write the binary container described by SSHeader instead of hexstring lines
+//
+uint64_t ss_encrypt_file_threads(
+    FILE *infile, FILE *outfile, const mpz_t n, int threads, bool binary) {
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    // Calculate block size k as ss_encrypt_file does
+    size_t k = ss_block_size(n);
+    if (k < 2) {
+        fprintf(stderr, "Error: public key is too small to encrypt with.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t log2p = mpz_sizeinbase(n, 2);
+    size_t width = (log2p + 7) / 8;
+
+    // Allocate one block buffer, every mpz_t of a batch, and the output buffer up front
+    size_t capacity = (size_t) threads * BATCH_PER_THREAD;
+    SSBatch batch;
+    batch.in = (mpz_t *) malloc(capacity * sizeof(mpz_t));
+    batch.out = (mpz_t *) malloc(capacity * sizeof(mpz_t));
+    batch.enc = (SSEncCtx *) malloc(threads * sizeof(SSEncCtx));
+    batch.dec = NULL;
+    uint8_t *block = (uint8_t *) malloc(k * sizeof(uint8_t));
+    char *hexstr = (char *) malloc(mpz_sizeinbase(n, 16) + 2);
+    uint8_t *records = (uint8_t *) malloc(capacity * width);
+    if (batch.in == NULL || batch.out == NULL || batch.enc == NULL || block == NULL
+        || hexstr == NULL || records == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        mpz_init2(batch.in[i], k * 8);
+        mpz_init2(batch.out[i], log2p);
+    }
+    for (int i = 0; i < threads; i++) {
+        ss_enc_init(&batch.enc[i], n);
+    }
+    Pool *pool = pool_create(threads);
 
-        mpz_clear(m);
-        mpz_clear(c);
+    // The block count is filled in at the end if outfile can be seeked
+    SSHeader header = { SS_VERSION, width, k - 1, SS_UNKNOWN_COUNT };
+    long header_offset = -1;
+    if (binary) {
+        header_offset = ftell(outfile);
+        ss_write_header(outfile, &header);
     }
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
 
+    bool eof = false;
+    while (!eof) {
+        // Read a batch of blocks, each prefixed with 0xFF
+        batch.count = 0;
+        size_t j;
+        while (batch.count < capacity
+               && (j = fread(block + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
+            block[0] = 0xFF;
+            mpz_import(batch.in[batch.count++], j + 1, 1, sizeof(uint8_t), 1, 0, block);
+            bytes += j;
+        }
+        eof = batch.count < capacity;
+        if (batch.count == 0) {
+            break;
+        }
+
+        pool_run(pool, ss_encrypt_batch, &batch);
+        blocks += batch.count;
+
+        // Write encrypted blocks to outfile in order, as one run of fixed-width records or as
+        // hexstring lines
+        if (binary) {
+            memset(records, 0, batch.count * width);
+            for (size_t i = 0; i < batch.count; i++) {
+                size_t size = (mpz_sizeinbase(batch.out[i], 2) + 7) / 8;
+                mpz_export(records + (i + 1) * width - size, NULL, 1, 1, 1, 0, batch.out[i]);
+            }
+            fwrite(records, width, batch.count, outfile);
+        } else {
+            for (size_t i = 0; i < batch.count; i++) {
+                mpz_get_str(hexstr, 16, batch.out[i]);
+                fputs(hexstr, outfile);
+                fputc('\n', outfile);
+            }
+        }
+    }
+
+    if (binary && header_offset >= 0 && fseek(outfile, header_offset, SEEK_SET) == 0) {
+        header.blocks = blocks;
+        ss_write_header(outfile, &header);
+        fseek(outfile, 0, SEEK_END);
+    }
+
+    pool_delete(pool);
+    for (int i = 0; i < threads; i++) {
+        ss_enc_clear(&batch.enc[i]);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        mpz_clears(batch.in[i], batch.out[i], NULL);
+    }
+    free(batch.in);
+    free(batch.out);
+    free(batch.enc);
     free(block);
+    free(hexstr);
+    free(records);
+    return bytes;
 }
 
 //
@@ -282,45 +583,888 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
 //  pq: private modulus
 //
 void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
-    // Calculate k
-    int b = 8;
-    int c = 2;
-    int k = (mpz_sizeinbase(pq, 2) - 1) / (b * c);
+    // Wrap the key in an SSPriv without CRT components
+    SSPriv key;
+    ss_priv_init(&key);
+    mpz_set(key.pq, pq);
+    mpz_set(key.d, d);
 
-    // Allocate memory for block
-    uint8_t *block = malloc(k);
+    ss_decrypt_file_key(infile, outfile, &key);
 
-    // Initialize temporary variables
+    ss_priv_clear(&key);
+}
+
+//
+// Initializes every component of an SS private key.
+//
+// Requires:
+//  key: key to initialize, cleared with ss_priv_clear
+//
+void ss_priv_init(SSPriv *key) {
+    mpz_inits(key->pq, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+    key->crt = false;
+}
+
+//
+// Frees every component of an SS private key.
+//
+void ss_priv_clear(SSPriv *key) {
+    mpz_clears(key->pq, key->d, key->p, key->q, key->dp, key->dq, key->qinv, NULL);
+}
+
+//
+// Checks the CRT components of a private key against pq and d.
+//
+// Provides:
+//  true if p * q = pq with p, q > 1, dp = d mod (p - 1), dq = d mod (q - 1) and
+//  qinv * q = 1 mod p, false otherwise
+//
+// Requires:
+//  key: private key whose pq, d, p, q, dp, dq and qinv are set
+//
+bool ss_priv_crt_valid(const SSPriv *key) {
+    if (mpz_cmp_ui(key->p, 1) <= 0 || mpz_cmp_ui(key->q, 1) <= 0) {
+        return false;
+    }
+    mpz_t t, m;
+    mpz_inits(t, m, NULL);
+    mpz_mul(t, key->p, key->q);
+    bool valid = mpz_cmp(t, key->pq) == 0;
+
+    // dp and dq must be d reduced modulo p - 1 and q - 1
+    mpz_sub_ui(m, key->p, 1);
+    mpz_mod(t, key->d, m);
+    valid = valid && mpz_cmp(t, key->dp) == 0;
+    mpz_sub_ui(m, key->q, 1);
+    mpz_mod(t, key->d, m);
+    valid = valid && mpz_cmp(t, key->dq) == 0;
+
+    // qinv must be the inverse of q modulo p
+    mpz_mul(t, key->qinv, key->q);
+    mpz_mod(t, t, key->p);
+    valid = valid && mpz_cmp_ui(t, 1) == 0;
+
+    mpz_clears(t, m, NULL);
+    return valid;
+}
+
+//
+// Generates a complete SS private key, including the CRT components.
+//
+// Provides:
+//  key: pq, d, p, q, dp, dq and qinv, with crt set
+//
+// Requires:
+//  p:  first prime number
+//  q: second prime number
+//  key: initialized with ss_priv_init
+//
+void ss_make_priv_key(SSPriv *key, const mpz_t p, const mpz_t q) {
+    ss_make_priv(key->d, key->pq, p, q);
+    mpz_set(key->p, p);
+    mpz_set(key->q, q);
+
+    // Reduce the private exponent modulo p-1 and q-1 (Fermat)
+    mpz_sub_ui(key->dp, p, 1);
+    mpz_mod(key->dp, key->d, key->dp);
+    mpz_sub_ui(key->dq, q, 1);
+    mpz_mod(key->dq, key->d, key->dq);
+
+    // Compute q^-1 mod p for Garner's recombination
+    mod_inverse(key->qinv, q, p);
+    key->crt = true;
+}
+
+//
+// Export SS private key to output stream in the extended format: pq and d, as written by
+// ss_write_priv, followed by p, q, dp, dq and qinv if the key has them, one hexstring per line.
+//
+// Requires:
+//  key: private key
+//  pvfile: open and writable file stream
+//
+void ss_write_priv_key(const SSPriv *key, FILE *pvfile) {
+    ss_write_priv(key->pq, key->d, pvfile);
+    if (key->crt) {
+        gmp_fprintf(pvfile, "%Zx\n%Zx\n%Zx\n%Zx\n%Zx\n", key->p, key->q, key->dp, key->dq,
+            key->qinv);
+    }
+}
+
+//
+// Import SS private key from input stream. Both the extended format and the original two-line
+// format are accepted; crt is set only if all seven components were read.
+//
+// Provides:
+//  key: private key
+//
+// Requires:
+//  pvfile: open and readable file stream
+//  key: initialized with ss_priv_init
+//
+// Returns false if pq and d could not be read.
+//
+bool ss_read_priv_key(SSPriv *key, FILE *pvfile) {
+    mpz_ptr fields[] = { key->pq, key->d, key->p, key->q, key->dp, key->dq, key->qinv };
+    size_t nfields = sizeof(fields) / sizeof(fields[0]);
     char *line = NULL;
     size_t len = 0;
-    ssize_t read;
+    size_t read = 0;
+
+    // Read one hexstring per line until the fields run out or the file does
+    while (read < nfields && getline(&line, &len, pvfile) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || mpz_set_str(fields[read], line, 16) != 0) {
+            break;
+        }
+        read++;
+    }
+    free(line);
+
+    key->crt = read == nfields && ss_priv_crt_valid(key);
+    return read >= 2;
+}
+
+//
+// Decrypt number c into number m with a private key, using two half-size exponentiations
+// recombined with Garner's formula when the key has its CRT components.
+//
+// Provides:
+//  m: decrypted/original integer
+//
+// Requires:
+//  c: encrypted integer
+//  key: private key
+//  all mpz_t arguments to be initialized
+//
+void ss_decrypt_key(mpz_t m, const mpz_t c, const SSPriv *key) {
+    if (!key->crt) {
+        ss_decrypt(m, c, key->d, key->pq);
+        return;
+    }
+
+    mpz_t mp, mq, h;
+    mpz_inits(mp, mq, h, NULL);
+
+    // mp = c^dp mod p and mq = c^dq mod q
+    mpz_mod(h, c, key->p);
+    pow_mod(mp, h, key->dp, key->p);
+    mpz_mod(h, c, key->q);
+    pow_mod(mq, h, key->dq, key->q);
+
+    // m = mq + q * (qinv * (mp - mq) mod p)
+    mpz_sub(h, mp, mq);
+    mpz_mul(h, h, key->qinv);
+    mpz_mod(h, h, key->p);
+    mpz_mul(h, h, key->q);
+    mpz_add(m, mq, h);
+
+    mpz_clears(mp, mq, h, NULL);
+}
+
+//
+// Decrypt a file back into its original form with a private key.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  key: private key
+//
+void ss_decrypt_file_key(FILE *infile, FILE *outfile, const SSPriv *key) {
+    ss_decrypt_file_threads(infile, outfile, key, 1);
+}
 
-    // Iterate over lines in infile
-    while ((read = getline(&line, &len, infile)) != -1) {
-        // Convert hex string to mpz_t
-        mpz_t c;
-        mpz_init(c);
-        mpz_set_str(c, line, 16);
+//
+// Prepares a decryption context for a private key.
+//
+// Requires:
+//  key: private key, which must outlive the context
+//  ctx: cleared with ss_dec_clear when no longer needed
+//
+void ss_dec_init(SSDecCtx *ctx, const SSPriv *key) {
+    ctx->key = key;
+    if (key->crt) {
+        mont_init(&ctx->mont_p, key->p);
+        mont_init(&ctx->mont_q, key->q);
+        mont_recode(&ctx->rec_p, key->dp);
+        mont_recode(&ctx->rec_q, key->dq);
+    } else {
+        mont_init(&ctx->mont_p, key->pq);
+        mont_recode(&ctx->rec_p, key->d);
+    }
+    mpz_init2(ctx->mp, mpz_sizeinbase(key->pq, 2));
+    mpz_init2(ctx->mq, mpz_sizeinbase(key->pq, 2));
+    mpz_init2(ctx->h, 2 * mpz_sizeinbase(key->pq, 2));
+}
 
-        // Decrypt using RSA
-        mpz_t m;
-        mpz_init(m);
-        mpz_powm(m, c, d, pq);
+//
+// Frees the memory used by a decryption context.
+//
+void ss_dec_clear(SSDecCtx *ctx) {
+    mont_clear(&ctx->mont_p);
+    mont_recoding_clear(&ctx->rec_p);
+    if (ctx->key->crt) {
+        mont_clear(&ctx->mont_q);
+        mont_recoding_clear(&ctx->rec_q);
+    }
+    mpz_clears(ctx->mp, ctx->mq, ctx->h, NULL);
+}
 
-        // Convert decrypted value to bytes
-        // Export m to block
-        size_t block_size;
-        mpz_export(&block[0], &block_size, 1, 1, 0, 0, m);
+//
+// Decrypt number c into number m with a prepared context. Gives the same result as
+// ss_decrypt_key.
+//
+// Provides:
+//  m: decrypted/original integer
+//
+// Requires:
+//  c: encrypted integer
+//  ctx: initialized with ss_dec_init
+//  all mpz_t arguments to be initialized
+//
+void ss_decrypt_ctx(mpz_t m, const mpz_t c, SSDecCtx *ctx) {
+    const SSPriv *key = ctx->key;
+    if (!key->crt) {
+        mont_pow_recoded(m, c, &ctx->rec_p, &ctx->mont_p);
+        return;
+    }
+
+    // mp = c^dp mod p and mq = c^dq mod q; mont_pow_recoded reduces c itself
+    mont_pow_recoded(ctx->mp, c, &ctx->rec_p, &ctx->mont_p);
+    mont_pow_recoded(ctx->mq, c, &ctx->rec_q, &ctx->mont_q);
 
-        // Write bytes from block to outfile, but skip the first byte
-        fwrite(block + 1, 1, block_size - 1, outfile);
+    // m = mq + q * (qinv * (mp - mq) mod p)
+    mpz_sub(ctx->h, ctx->mp, ctx->mq);
+    mpz_mul(ctx->h, ctx->h, key->qinv);
+    mpz_mod(ctx->h, ctx->h, key->p);
+    mpz_mul(ctx->h, ctx->h, key->q);
+    mpz_add(m, ctx->mq, ctx->h);
+}
 
-        // Clear temporary variables
-        mpz_clear(c);
-        mpz_clear(m);
+// Decrypts this thread's share of a batch with its own context.
+static void ss_decrypt_batch(void *arg, int id, int threads) {
+    SSBatch *batch = (SSBatch *) arg;
+    for (size_t i = id; i < batch->count; i += threads) {
+        ss_decrypt_ctx(batch->out[i], batch->in[i], &batch->dec[id]);
+    }
+}
+
+// Writes size bytes to outfile, dropping them while *skip is positive and stopping once *len
+// bytes have been written, and updates both. Returns the number of bytes written.
+static size_t ss_write_trimmed(
+    FILE *outfile, const uint8_t *bytes, size_t size, uint64_t *skip, uint64_t *len) {
+    size_t drop = *skip < size ? *skip : size;
+    *skip -= drop;
+    size -= drop;
+    if (size > *len) {
+        size = *len;
+    }
+    fwrite(bytes + drop, 1, size, outfile);
+    *len -= size;
+    return size;
+}
+
+// Decrypts ciphertext blocks from infile, which is positioned at the first of them, on threads
+// threads. header is NULL for hexstring lines; binary records are read up to records of them,
+// which must all be there if exact is set. The first skip bytes of plaintext are dropped and at
+// most len bytes are written. Returns the number of bytes written.
+static uint64_t ss_decrypt_blocks(FILE *infile, FILE *outfile, const SSPriv *key, int threads,
+    const SSHeader *header, uint64_t records_left, bool exact, uint64_t skip, uint64_t len) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    bool binary = header != NULL;
+    size_t width = binary ? header->width : 0;
+
+    // Every decrypted block is less than pq, so it fits in as many bytes as pq
+    size_t pq_bits = mpz_sizeinbase(key->pq, 2);
+    size_t k = (pq_bits + 7) / 8;
+
+    // Binary files record the block size they were written with, and blocks that may not be less
+    // than pq cannot have survived encryption
+    if (binary && 8 * ((uint64_t) header->block_bytes + 1) > pq_bits - 1) {
+        fprintf(stderr, "Error: ciphertext blocks are too large for this key.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Allocate the block buffer, every mpz_t of a batch, and one context per thread up front
+    size_t capacity = (size_t) threads * BATCH_PER_THREAD;
+    SSBatch batch;
+    batch.in = (mpz_t *) malloc(capacity * sizeof(mpz_t));
+    batch.out = (mpz_t *) malloc(capacity * sizeof(mpz_t));
+    batch.dec = (SSDecCtx *) malloc(threads * sizeof(SSDecCtx));
+    batch.enc = NULL;
+    uint8_t *block = malloc(k);
+    uint8_t *records = binary ? malloc(capacity * width) : NULL;
+    if (batch.in == NULL || batch.out == NULL || batch.dec == NULL || block == NULL
+        || (binary && records == NULL)) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        mpz_init2(batch.in[i], 8 * k);
+        mpz_init2(batch.out[i], 8 * k);
+    }
+    for (int i = 0; i < threads; i++) {
+        ss_dec_init(&batch.dec[i], key);
+    }
+    Pool *pool = pool_create(threads);
+
+    // Initialize temporary variables
+    char *line = NULL;
+    size_t line_size = 0;
+    bool eof = false;
+    uint64_t remaining = records_left;
+    uint64_t written = 0;
+
+    while (!eof && len > 0) {
+        batch.count = 0;
+        if (binary) {
+            // Read a batch of fixed-width records in one call
+            size_t want = remaining < capacity ? remaining : capacity;
+            batch.count = fread(records, width, want, infile);
+            for (size_t i = 0; i < batch.count; i++) {
+                mpz_import(batch.in[i], width, 1, 1, 1, 0, records + i * width);
+            }
+            remaining -= batch.count;
+            eof = batch.count < capacity;
+            if (batch.count < want && exact) {
+                fprintf(stderr, "Error: ciphertext is missing blocks.\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            // Parse a batch of hexstring lines
+            while (batch.count < capacity && getline(&line, &line_size, infile) != -1) {
+                line[strcspn(line, "\n")] = '\0';
+                if (mpz_set_str(batch.in[batch.count++], line, 16) != 0) {
+                    fprintf(stderr, "Error: invalid ciphertext block.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            eof = batch.count < capacity;
+        }
+        if (batch.count == 0) {
+            break;
+        }
+
+        pool_run(pool, ss_decrypt_batch, &batch);
+
+        for (size_t i = 0; i < batch.count; i++) {
+            // Export m to block
+            size_t block_size = 0;
+            mpz_export(block, &block_size, 1, 1, 0, 0, batch.out[i]);
+
+            // Write bytes from block to outfile, but skip the first byte
+            if (block_size > 1) {
+                written += ss_write_trimmed(outfile, block + 1, block_size - 1, &skip, &len);
+            }
+        }
     }
 
     // Free memory
+    pool_delete(pool);
+    for (int i = 0; i < threads; i++) {
+        ss_dec_clear(&batch.dec[i]);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        mpz_clears(batch.in[i], batch.out[i], NULL);
+    }
+    free(batch.in);
+    free(batch.out);
+    free(batch.dec);
     free(block);
+    free(records);
     free(line);
+    return written;
+}
+
+static uint64_t ss_decrypt_hybrid(
+    FILE *infile, FILE *outfile, const SSPriv *key, const uint8_t *header);
+
+//
+// Decrypt a file back into its original form on several threads. Ciphertext blocks are parsed in
+// batches on the calling thread, decrypted on every thread of the pool, and written in their
+// original order.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  key: private key
+//  threads: number of threads to decrypt on, counting the calling thread
+//
+uint64_t ss_decrypt_file_threads(FILE *infile, FILE *outfile, const SSPriv *key, int threads) {
+    // Binary files start with SS_MAGIC, whose first character cannot start a hexstring
+    SSHeader header = { 0, 0, 0, 0 };
+    int first = getc(infile);
+    bool binary = first == SS_MAGIC[0];
+    if (first != EOF) {
+        ungetc(first, infile);
+    }
+    if (binary) {
+        // Hybrid and multi-recipient files start with the same letter, so the whole magic decides
+        // how the rest of the file is read
+        uint8_t bytes[SS_HEADER_SIZE + SS_HYBRID_HEADER_SIZE];
+        bool valid = fread(bytes, 1, 4, infile) == 4;
+        if (valid
+            && (memcmp(bytes, SS_HYBRID_MAGIC, 4) == 0 || memcmp(bytes, SS_MULTI_MAGIC, 4) == 0)) {
+            size_t rest = SS_HYBRID_HEADER_SIZE - 4;
+            if (fread(bytes + 4, 1, rest, infile) != rest) {
+                fprintf(stderr, "Error: invalid hybrid ciphertext header.\n");
+                exit(EXIT_FAILURE);
+            }
+            return ss_decrypt_hybrid(infile, outfile, key, bytes);
+        }
+        valid = valid && fread(bytes + 4, 1, SS_HEADER_SIZE - 4, infile) == SS_HEADER_SIZE - 4
+                && ss_parse_header(bytes, &header);
+        if (!valid) {
+            fprintf(stderr, "Error: invalid ciphertext header.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return ss_decrypt_blocks(infile, outfile, key, threads, binary ? &header : NULL, header.blocks,
+        header.blocks != SS_UNKNOWN_COUNT, 0, UINT64_MAX);
+}
+
+//
+// Decrypt len bytes of plaintext starting at offset from a binary ciphertext file, reading and
+// decrypting only the records that cover them.
+//
+// Provides:
+//  fills outfile with up to len bytes of the original data from offset
+//
+// Requires:
+//  infile: open, readable and seekable file stream to a binary ciphertext file
+//  outfile: open and writable file stream
+//  key: private key
+//  threads: number of threads to decrypt on, counting the calling thread
+//
+uint64_t ss_decrypt_file_range(FILE *infile, FILE *outfile, const SSPriv *key, int threads,
+    uint64_t offset, uint64_t len) {
+    SSHeader header;
+    if (!ss_read_header(infile, &header) || header.block_bytes == 0) {
+        fprintf(stderr, "Error: random access needs a binary ciphertext file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every block but the last holds block_bytes of plaintext, so the records covering the range
+    // are found by division, and record i starts i * width bytes after the header
+    uint64_t first = offset / header.block_bytes;
+    uint64_t end = len > UINT64_MAX - offset ? UINT64_MAX : offset + len;
+    uint64_t last = end / header.block_bytes + (end % header.block_bytes != 0);
+    if (header.blocks != SS_UNKNOWN_COUNT && last > header.blocks) {
+        last = header.blocks;
+    }
+    if (len == 0 || first >= last) {
+        return 0;
+    }
+    if (fseeko(infile, (off_t) (first * header.width), SEEK_CUR) != 0) {
+        fprintf(stderr, "Error: unable to seek in ciphertext file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Without a block count, the records are read until the range is covered or the file ends
+    bool known = header.blocks != SS_UNKNOWN_COUNT;
+    return ss_decrypt_blocks(infile, outfile, key, threads, &header, last - first, known,
+        offset - first * header.block_bytes, len);
+}
+
+// Fills bytes with len bytes from the operating system's cryptographic random number generator.
+static void ss_random_bytes(uint8_t *bytes, size_t len) {
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (urandom == NULL || fread(bytes, 1, len, urandom) != len) {
+        fprintf(stderr, "Error: unable to read random bytes.\n");
+        exit(EXIT_FAILURE);
+    }
+    fclose(urandom);
+}
+
+// Pads a message of len bytes authenticated with mac with zeros to a multiple of 16 bytes.
+static void ss_hybrid_pad(Poly1305 *mac, uint64_t len) {
+    static const uint8_t zeros[POLY1305_BLOCK_SIZE] = { 0 };
+    size_t pad = (POLY1305_BLOCK_SIZE - len % POLY1305_BLOCK_SIZE) % POLY1305_BLOCK_SIZE;
+    poly1305_update(mac, zeros, pad);
+}
+
+// Starts the ChaCha20 stream and the Poly1305 authenticator of a hybrid or multi-recipient file.
+// The one-time Poly1305 key is the first half of block 0, which is then discarded so the data is
+// encrypted from block 1 on. The header is authenticated ahead of the data, padded to 16 bytes.
+static void ss_hybrid_init(
+    ChaCha *cipher, Poly1305 *mac, const uint8_t *key, const uint8_t *header) {
+    uint8_t block[CHACHA_BLOCK_SIZE] = { 0 };
+    chacha_init(cipher, key, header + 12);
+    chacha_xor(cipher, block, block, sizeof(block));
+    poly1305_init(mac, block);
+    memset(block, 0, sizeof(block));
+
+    poly1305_update(mac, header, SS_HYBRID_HEADER_SIZE);
+    ss_hybrid_pad(mac, SS_HYBRID_HEADER_SIZE);
+}
+
+// Finishes the Poly1305 tag of a file whose encrypted data is bytes long: the data is padded to 16
+// bytes and followed by the lengths of the header and the data.
+static void ss_hybrid_tag(Poly1305 *mac, uint8_t *tag, uint64_t bytes) {
+    uint8_t lengths[16];
+    ss_put_le(lengths, SS_HYBRID_HEADER_SIZE, 8);
+    ss_put_le(lengths + 8, bytes, 8);
+    ss_hybrid_pad(mac, bytes);
+    poly1305_update(mac, lengths, sizeof(lengths));
+    poly1305_finish(mac, tag);
+}
+
+// Encrypts infile into outfile with ChaCha20 until the end of infile, authenticating the encrypted
+// data, and appends the tag. Returns the number of bytes encrypted.
+static uint64_t ss_chacha_seal(FILE *infile, FILE *outfile, ChaCha *cipher, Poly1305 *mac) {
+    uint8_t *chunk = malloc(HYBRID_CHUNK);
+    if (chunk == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t read = 0;
+    uint64_t total = 0;
+    while ((read = fread(chunk, 1, HYBRID_CHUNK, infile)) > 0) {
+        chacha_xor(cipher, chunk, chunk, read);
+        poly1305_update(mac, chunk, read);
+        fwrite(chunk, 1, read, outfile);
+        total += read;
+    }
+    uint8_t tag[SS_HYBRID_TAG_SIZE];
+    ss_hybrid_tag(mac, tag, total);
+    fwrite(tag, 1, sizeof(tag), outfile);
+    free(chunk);
+    return total;
+}
+
+// Authenticates the encrypted data of infile up to its tag, and decrypts it into outfile unless
+// outfile is NULL. The last SS_HYBRID_TAG_SIZE bytes are held back until the end of infile shows
+// they are the tag. Returns false if the file is too short to hold a tag or the tag does not match;
+// *bytes is the number of bytes of data.
+static bool ss_chacha_open(
+    FILE *infile, FILE *outfile, ChaCha *cipher, Poly1305 *mac, uint64_t *bytes) {
+    uint8_t *chunk = malloc(HYBRID_CHUNK + SS_HYBRID_TAG_SIZE);
+    if (chunk == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t held = 0;
+    size_t read = 0;
+    *bytes = 0;
+    while ((read = fread(chunk + held, 1, HYBRID_CHUNK, infile)) > 0) {
+        held += read;
+        if (held > SS_HYBRID_TAG_SIZE) {
+            size_t len = held - SS_HYBRID_TAG_SIZE;
+            poly1305_update(mac, chunk, len);
+            if (outfile != NULL) {
+                chacha_xor(cipher, chunk, chunk, len);
+                fwrite(chunk, 1, len, outfile);
+            }
+            memmove(chunk, chunk + len, SS_HYBRID_TAG_SIZE);
+            held = SS_HYBRID_TAG_SIZE;
+            *bytes += len;
+        }
+    }
+
+    // Compare every byte, so the time taken does not tell how much of the tag was right
+    uint8_t tag[SS_HYBRID_TAG_SIZE];
+    ss_hybrid_tag(mac, tag, *bytes);
+    uint8_t diff = held == SS_HYBRID_TAG_SIZE ? 0 : 1;
+    for (size_t i = 0; i < SS_HYBRID_TAG_SIZE; i++) {
+        diff |= tag[i] ^ chunk[i];
+    }
+    free(chunk);
+    return diff == 0;
+}
+
+// Encrypts the wrapped session key with n into a width-byte record, right-aligned like the records
+// of binary ciphertext files. Exits if n is too small for the wrapped key to decrypt.
+static void ss_wrap_key(uint8_t *record, uint32_t width, const uint8_t *wrapped, const mpz_t n) {
+    // The session key is wrapped as 0xFF followed by the key, like a block of ss_encrypt_file, so
+    // it has to fit in a block
+    size_t nbits = mpz_sizeinbase(n, 2);
+    if (ss_block_size(n) < 1 + CHACHA_KEY_SIZE) {
+        fprintf(stderr, "Error: public key is too small for hybrid mode (%zu bits, needs %d).\n",
+            nbits, 16 * (1 + CHACHA_KEY_SIZE) + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    mpz_t m, c;
+    mpz_inits(m, c, NULL);
+    mpz_import(m, 1 + CHACHA_KEY_SIZE, 1, 1, 1, 0, wrapped);
+    ss_encrypt(c, m, n);
+    size_t size = (mpz_sizeinbase(c, 2) + 7) / 8;
+    memset(record, 0, width);
+    mpz_export(record + width - size, NULL, 1, 1, 1, 0, c);
+    mpz_clears(m, c, NULL);
+}
+
+// Decrypts a width-byte record made by ss_wrap_key. Returns false if it was not wrapped for key,
+// which shows as a missing 0xFF prefix.
+static bool ss_unwrap_key(
+    uint8_t *wrapped, const uint8_t *record, uint32_t width, const SSPriv *key) {
+    mpz_t c, m;
+    mpz_inits(c, m, NULL);
+    mpz_import(c, width, 1, 1, 1, 0, record);
+    ss_decrypt_key(m, c, key);
+    bool valid = (mpz_sizeinbase(m, 2) + 7) / 8 == 1 + CHACHA_KEY_SIZE;
+    if (valid) {
+        mpz_export(wrapped, NULL, 1, 1, 1, 0, m);
+        valid = wrapped[0] == 0xFF;
+    }
+    mpz_clears(c, m, NULL);
+    return valid;
+}
+
+//
+// Fingerprint of a public key: the 64-bit FNV-1a hash of n in big-endian bytes. It tells keys
+// apart, but it is not a cryptographic hash.
+//
+// Provides:
+//  fingerprint: SS_FINGERPRINT_SIZE bytes identifying n
+//
+// Requires:
+//  n: public exponent and modulus
+//
+void ss_fingerprint(uint8_t *fingerprint, const mpz_t n) {
+    size_t size = (mpz_sizeinbase(n, 2) + 7) / 8;
+    uint8_t *bytes = malloc(size);
+    if (bytes == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    mpz_export(bytes, &size, 1, 1, 1, 0, n);
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    ss_put_le(fingerprint, hash, SS_FINGERPRINT_SIZE);
+    free(bytes);
+}
+
+//
+// Encrypt an arbitrary file in hybrid mode: a random ChaCha20 session key is encrypted once with
+// the public key, and the data itself is encrypted with ChaCha20 under the session key.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus, large enough that the session key is less than pq
+//
+uint64_t ss_encrypt_file_hybrid(FILE *infile, FILE *outfile, const mpz_t n) {
+    uint8_t wrapped[1 + CHACHA_KEY_SIZE];
+    uint8_t nonce[CHACHA_NONCE_SIZE];
+    wrapped[0] = 0xFF;
+    ss_random_bytes(wrapped + 1, CHACHA_KEY_SIZE);
+    ss_random_bytes(nonce, sizeof(nonce));
+
+    // Header, then the wrapped key right-aligned in a record as wide as n
+    uint32_t width = (mpz_sizeinbase(n, 2) + 7) / 8;
+    uint8_t *record = malloc(width);
+    if (record == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+        exit(EXIT_FAILURE);
+    }
+    ss_wrap_key(record, width, wrapped, n);
+    uint8_t header[SS_HYBRID_HEADER_SIZE] = { 0 };
+    memcpy(header, SS_HYBRID_MAGIC, 4);
+    ss_put_le(header + 4, SS_HYBRID_VERSION, 2);
+    ss_put_le(header + 8, width, 4);
+    memcpy(header + 12, nonce, sizeof(nonce));
+    fwrite(header, 1, sizeof(header), outfile);
+    fwrite(record, 1, width, outfile);
+
+    ChaCha cipher;
+    Poly1305 mac;
+    ss_hybrid_init(&cipher, &mac, wrapped + 1, header);
+    uint64_t bytes = ss_chacha_seal(infile, outfile, &cipher, &mac);
+
+    // Do not leave the session key behind in memory
+    memset(wrapped, 0, sizeof(wrapped));
+    memset(&cipher, 0, sizeof(cipher));
+    memset(&mac, 0, sizeof(mac));
+    free(record);
+    return bytes;
+}
+
+//
+// Encrypt an arbitrary file once for several recipients: the data is encrypted with ChaCha20
+// under a random session key as in hybrid mode, and only the session key is encrypted with each
+// public key.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: count public keys, each large enough for hybrid mode
+//  count: number of recipients, at least 1
+//
+uint64_t ss_encrypt_file_multi(FILE *infile, FILE *outfile, const mpz_t n[], uint32_t count) {
+    uint8_t wrapped[1 + CHACHA_KEY_SIZE];
+    uint8_t nonce[CHACHA_NONCE_SIZE];
+    wrapped[0] = 0xFF;
+    ss_random_bytes(wrapped + 1, CHACHA_KEY_SIZE);
+    ss_random_bytes(nonce, sizeof(nonce));
+
+    uint8_t header[SS_HYBRID_HEADER_SIZE] = { 0 };
+    memcpy(header, SS_MULTI_MAGIC, 4);
+    ss_put_le(header + 4, SS_MULTI_VERSION, 2);
+    ss_put_le(header + 8, count, 4);
+    memcpy(header + 12, nonce, sizeof(nonce));
+    fwrite(header, 1, sizeof(header), outfile);
+
+    // One entry per recipient: fingerprint, record width, and the session key wrapped for them
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t width = (mpz_sizeinbase(n[i], 2) + 7) / 8;
+        uint8_t *entry = malloc(SS_MULTI_ENTRY_SIZE + width);
+        if (entry == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+            exit(EXIT_FAILURE);
+        }
+        ss_fingerprint(entry, n[i]);
+        ss_put_le(entry + SS_FINGERPRINT_SIZE, width, 4);
+        ss_wrap_key(entry + SS_MULTI_ENTRY_SIZE, width, wrapped, n[i]);
+        fwrite(entry, 1, SS_MULTI_ENTRY_SIZE + width, outfile);
+        free(entry);
+    }
+
+    ChaCha cipher;
+    Poly1305 mac;
+    ss_hybrid_init(&cipher, &mac, wrapped + 1, header);
+    uint64_t bytes = ss_chacha_seal(infile, outfile, &cipher, &mac);
+
+    memset(wrapped, 0, sizeof(wrapped));
+    memset(&cipher, 0, sizeof(cipher));
+    memset(&mac, 0, sizeof(mac));
+    return bytes;
+}
+
+// Reads the recipient entries of a multi-recipient file and recovers the session key wrapped for
+// key. The entry whose fingerprint matches n = p * pq is tried first; keys without p cannot
+// compute n, so every entry is tried in turn. Returns false if no entry decrypts with key.
+static bool ss_find_multi_key(
+    FILE *infile, uint8_t *wrapped, uint32_t count, const SSPriv *key) {
+    uint8_t mine[SS_FINGERPRINT_SIZE] = { 0 };
+    if (key->crt) {
+        mpz_t n;
+        mpz_init(n);
+        mpz_mul(n, key->p, key->pq);
+        ss_fingerprint(mine, n);
+        mpz_clear(n);
+    }
+
+    bool found = false;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t entry[SS_MULTI_ENTRY_SIZE];
+        if (fread(entry, 1, sizeof(entry), infile) != sizeof(entry)) {
+            return false;
+        }
+        uint32_t width = ss_get_le(entry + SS_FINGERPRINT_SIZE, 4);
+        uint8_t *record = malloc(width == 0 ? 1 : width);
+        if (record == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+            exit(EXIT_FAILURE);
+        }
+        bool complete = fread(record, 1, width, infile) == width;
+        if (complete && !found
+            && (!key->crt || memcmp(entry, mine, SS_FINGERPRINT_SIZE) == 0)) {
+            found = ss_unwrap_key(wrapped, record, width, key);
+        }
+        free(record);
+        if (!complete) {
+            return false;
+        }
+    }
+    return found;
+}
+
+//
+// Decrypt the rest of a file written by ss_encrypt_file_hybrid or ss_encrypt_file_multi, whose
+// SS_HYBRID_HEADER_SIZE byte header has already been read into header.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream, positioned just past the header
+//  outfile: open and writable file stream
+//  key: private key
+//  header: the header of the file
+//
+static uint64_t ss_decrypt_hybrid(
+    FILE *infile, FILE *outfile, const SSPriv *key, const uint8_t *header) {
+    bool multi = false;
+    if (!((memcmp(header, SS_HYBRID_MAGIC, 4) == 0
+                 && ss_get_le(header + 4, 2) == SS_HYBRID_VERSION)
+             || (multi = memcmp(header, SS_MULTI_MAGIC, 4) == 0
+                         && ss_get_le(header + 4, 2) == SS_MULTI_VERSION))) {
+        fprintf(stderr, "Error: invalid hybrid ciphertext header.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Recover the session key, checking its 0xFF prefix to catch the wrong private key
+    uint8_t wrapped[1 + CHACHA_KEY_SIZE];
+    bool found = false;
+    if (multi) {
+        found = ss_find_multi_key(infile, wrapped, ss_get_le(header + 8, 4), key);
+    } else {
+        uint32_t width = ss_get_le(header + 8, 4);
+        uint8_t *record = malloc(width == 0 ? 1 : width);
+        if (record == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for block.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (fread(record, 1, width, infile) != width) {
+            fprintf(stderr, "Error: ciphertext is missing the session key.\n");
+            exit(EXIT_FAILURE);
+        }
+        found = ss_unwrap_key(wrapped, record, width, key);
+        free(record);
+    }
+    if (!found) {
+        fprintf(stderr, "Error: session key does not decrypt with this private key.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A seekable file is authenticated in a first pass, so nothing of a forged file is written
+    ChaCha cipher;
+    Poly1305 mac;
+    uint64_t bytes = 0;
+    long start = ftell(infile);
+    bool valid = true;
+    if (start != -1) {
+        ss_hybrid_init(&cipher, &mac, wrapped + 1, header);
+        valid = ss_chacha_open(infile, NULL, &cipher, &mac, &bytes)
+                && fseek(infile, start, SEEK_SET) == 0;
+    }
+    if (valid) {
+        ss_hybrid_init(&cipher, &mac, wrapped + 1, header);
+        valid = ss_chacha_open(infile, outfile, &cipher, &mac, &bytes);
+    }
+
+    memset(wrapped, 0, sizeof(wrapped));
+    memset(&cipher, 0, sizeof(cipher));
+    memset(&mac, 0, sizeof(mac));
+    if (!valid) {
+        fprintf(stderr, "Error: ciphertext has been altered or is incomplete.\n");
+        exit(EXIT_FAILURE);
+    }
+    return bytes;
+}
+
+uint64_t ss_decrypt_file_hybrid(FILE *infile, FILE *outfile, const SSPriv *key) {
+    uint8_t header[SS_HYBRID_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), infile) != sizeof(header)) {
+        fprintf(stderr, "Error: invalid hybrid ciphertext header.\n");
+        exit(EXIT_FAILURE);
+    }
+    return ss_decrypt_hybrid(infile, outfile, key, header);
 }
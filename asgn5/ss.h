@@ -5,6 +5,79 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "montgomery.h"
+#include "randstate.h"
+
+#define SS_MAGIC         "SSCF" // Starts every binary ciphertext file; 'S' is not a hex digit.
+#define SS_VERSION       1
+#define SS_HEADER_SIZE   24 // Bytes in a binary ciphertext header.
+#define SS_UNKNOWN_COUNT UINT64_MAX // Block count of a file that could not be seeked to fill it in.
+
+#define SS_HYBRID_MAGIC       "SSCH" // Starts every hybrid ciphertext file.
+#define SS_HYBRID_VERSION     2
+#define SS_HYBRID_HEADER_SIZE 20 // Bytes in a hybrid ciphertext header, before the wrapped key.
+#define SS_HYBRID_TAG_SIZE    16 // Bytes in the Poly1305 tag ending hybrid and multi files.
+
+#define SS_MULTI_MAGIC       "SSCM" // Starts every multi-recipient ciphertext file.
+#define SS_MULTI_VERSION     2
+#define SS_FINGERPRINT_SIZE  8 // Bytes in a public key fingerprint.
+#define SS_MULTI_ENTRY_SIZE  12 // Bytes before the wrapped key of a recipient: fingerprint, width.
+
+#define SS_USERNAME_SIZE 256 // Bytes ss_read_pub may store in username, including the NUL.
+
+//
+// Header of a binary ciphertext file. It is followed by blocks records of width bytes each, every
+// one a ciphertext block written big-endian and zero-padded to the width of the modulus. On disk
+// the fields are little-endian, in the order SS_MAGIC, version, a reserved 16-bit field, width,
+// block_bytes and blocks.
+//
+typedef struct SSHeader {
+    uint16_t version;
+    uint32_t width; // bytes per record: the size of the modulus n in bytes
+    uint32_t block_bytes; // plaintext bytes per block, the last block may hold fewer
+    uint64_t blocks; // number of records, SS_UNKNOWN_COUNT if the writer could not seek
+} SSHeader;
+
+//
+// Precomputed state for encrypting many blocks under one public key: Montgomery constants for n,
+// the sliding-window recoding of the exponent n, and scratch space, so that encrypting a block
+// does not allocate memory.
+//
+typedef struct SSEncCtx {
+    MontCtx mont;
+    MontRecoding rec;
+} SSEncCtx;
+
+//
+// An SS private key. Keys written by older versions of keygen only hold pq and d; keys with crt
+// set also hold the components needed to decrypt modulo p and q separately (Chinese Remainder
+// Theorem), which is about four times faster than one exponentiation modulo pq.
+//
+typedef struct SSPriv {
+    mpz_t pq; // private modulus
+    mpz_t d; // private exponent
+    mpz_t p; // first prime
+    mpz_t q; // second prime
+    mpz_t dp; // d mod (p - 1)
+    mpz_t dq; // d mod (q - 1)
+    mpz_t qinv; // q^-1 mod p
+    bool crt;
+} SSPriv;
+
+//
+// Precomputed state for decrypting many blocks with one private key: Montgomery constants and
+// exponent recodings for p and q (or for pq if the key has no CRT components), and scratch space.
+// Each thread decrypting at the same time needs its own context.
+//
+typedef struct SSDecCtx {
+    const SSPriv *key;
+    MontCtx mont_p; // modulo p, or pq without CRT
+    MontCtx mont_q; // modulo q
+    MontRecoding rec_p; // dp, or d without CRT
+    MontRecoding rec_q; // dq
+    mpz_t mp, mq, h; // scratch
+} SSDecCtx;
+
 //
 // Generates the components for a new SS key.
 //
@@ -20,6 +93,42 @@
 //
 void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters);
 
+//
+// Generates the components for a new SS key on several threads. p and q are searched for at the
+// same time; every thread tests candidates from its own random stream, and the first prime found
+// for each of them cancels the other threads still searching for it.
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  iters: iterations of Miller-Rabin to use for primality check
+//  threads: number of threads to search on, counting the calling thread
+//  all mpz_t arguments to be initialized
+//
+void ss_make_pub_threads(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters, int threads);
+
+//
+// Generates the components for a new SS key on the calling thread, drawing every random number
+// from a stream instead of the random state, so that several keys can be generated at once on
+// different threads.
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  iters: iterations of Miller-Rabin to use for primality check
+//  rs: random stream used by this thread only
+//  all mpz_t arguments to be initialized
+//
+void ss_make_pub_stream(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters, RandStream *rs);
+
 //
 // Generates components for a new SS private key.
 //
@@ -63,7 +172,7 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile);
 //
 // Requires:
 //  pbfile: open and readable file stream
-//  username: requires sufficient space
+//  username: room for SS_USERNAME_SIZE bytes; longer names are truncated
 //  all mpz_t arguments to be initialized
 //
 void ss_read_pub(mpz_t n, char username[], FILE *pbfile);
@@ -94,6 +203,41 @@ void ss_read_priv(mpz_t pq, mpz_t d, FILE *pvfile);
 //
 void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n);
 
+//
+// Prepares an encryption context for public key n.
+//
+// Requires:
+//  n: public exponent/modulus
+//  ctx: cleared with ss_enc_clear when no longer needed
+//
+void ss_enc_init(SSEncCtx *ctx, const mpz_t n);
+
+//
+// Frees the memory used by an encryption context.
+//
+void ss_enc_clear(SSEncCtx *ctx);
+
+//
+// Encrypt number m into number c with a prepared context. Gives the same result as ss_encrypt.
+//
+// Provides:
+//  c: encrypted integer
+//
+// Requires:
+//  m: original integer
+//  ctx: initialized with ss_enc_init
+//  all mpz_t arguments to be initialized
+//
+void ss_encrypt_ctx(mpz_t c, const mpz_t m, SSEncCtx *ctx);
+
+//
+// Bytes in a plaintext block for the public modulus n, counting the 0xFF byte that starts every
+// block. Blocks must be less than pq to decrypt, and the encrypter only knows n = p^2 * q; since
+// p < pq, pq > sqrt(n), so any block of at most half the bits of n - 1 is safe. This is the largest
+// such block, and both the hexstring and binary formats use it.
+//
+size_t ss_block_size(const mpz_t n);
+
 //
 // Encrypt an arbitrary file
 //
@@ -107,6 +251,61 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n);
 //
 void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n);
 
+//
+// Encrypt an arbitrary file on several threads. Blocks are read in batches on the calling thread,
+// encrypted on every thread of the pool, and written in their original order, so the hexstring
+// output is identical to ss_encrypt_file.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  threads: number of threads to encrypt on, counting the calling thread
+//  binary: write the binary container described by SSHeader instead of hexstring lines
+//
+// Returns the number of plaintext bytes encrypted.
+//
+uint64_t ss_encrypt_file_threads(
+    FILE *infile, FILE *outfile, const mpz_t n, int threads, bool binary);
+
+//
+// Write a binary ciphertext header.
+//
+// Requires:
+//  outfile: open and writable file stream
+//  header: header to write
+//
+void ss_write_header(FILE *outfile, const SSHeader *header);
+
+//
+// Read a binary ciphertext header.
+//
+// Provides:
+//  header: header read from infile
+//
+// Requires:
+//  infile: open and readable file stream, positioned at the header
+//
+// Returns false if infile does not start with a binary ciphertext header of a known version.
+//
+bool ss_read_header(FILE *infile, SSHeader *header);
+
+//
+// Parse a binary ciphertext header from memory.
+//
+// Provides:
+//  header: header held in bytes
+//
+// Requires:
+//  bytes: the first SS_HEADER_SIZE bytes of a binary ciphertext file
+//
+// Returns false if bytes are not a binary ciphertext header of a known version.
+//
+bool ss_parse_header(const uint8_t *bytes, SSHeader *header);
+
 //
 // Decrypt number c into number m
 //
@@ -134,3 +333,241 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 //  pq: private modulus
 //
 void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+
+//
+// Initializes every component of an SS private key.
+//
+// Requires:
+//  key: key to initialize, cleared with ss_priv_clear
+//
+void ss_priv_init(SSPriv *key);
+
+//
+// Frees every component of an SS private key.
+//
+void ss_priv_clear(SSPriv *key);
+
+//
+// Checks that the CRT components of a private key agree with pq and d: p * q = pq with p, q > 1,
+// dp = d mod (p - 1), dq = d mod (q - 1) and qinv * q = 1 mod p. Keys read from files are checked
+// before their CRT components are used, since a wrong one would silently garble every block.
+//
+// Requires:
+//  key: private key whose pq, d, p, q, dp, dq and qinv are set
+//
+bool ss_priv_crt_valid(const SSPriv *key);
+
+//
+// Generates a complete SS private key, including the CRT components.
+//
+// Provides:
+//  key: pq, d, p, q, dp, dq and qinv, with crt set
+//
+// Requires:
+//  p:  first prime number
+//  q: second prime number
+//  key: initialized with ss_priv_init
+//
+void ss_make_priv_key(SSPriv *key, const mpz_t p, const mpz_t q);
+
+//
+// Export SS private key to output stream in the extended format: pq and d, as written by
+// ss_write_priv, followed by p, q, dp, dq and qinv if the key has them, one hexstring per line.
+//
+// Requires:
+//  key: private key
+//  pvfile: open and writable file stream
+//
+void ss_write_priv_key(const SSPriv *key, FILE *pvfile);
+
+//
+// Import SS private key from input stream. Both the extended format and the original two-line
+// format are accepted; crt is set only if all seven components were read and agree with each
+// other (see ss_priv_crt_valid). A key whose CRT components do not agree is used without them.
+//
+// Provides:
+//  key: private key
+//
+// Requires:
+//  pvfile: open and readable file stream
+//  key: initialized with ss_priv_init
+//
+// Returns false if pq and d could not be read.
+//
+bool ss_read_priv_key(SSPriv *key, FILE *pvfile);
+
+//
+// Decrypt number c into number m with a private key, using two half-size exponentiations
+// recombined with Garner's formula when the key has its CRT components.
+//
+// Provides:
+//  m: decrypted/original integer
+//
+// Requires:
+//  c: encrypted integer
+//  key: private key
+//  all mpz_t arguments to be initialized
+//
+void ss_decrypt_key(mpz_t m, const mpz_t c, const SSPriv *key);
+
+//
+// Decrypt a file back into its original form with a private key.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  key: private key
+//
+void ss_decrypt_file_key(FILE *infile, FILE *outfile, const SSPriv *key);
+
+//
+// Prepares a decryption context for a private key.
+//
+// Requires:
+//  key: private key, which must outlive the context
+//  ctx: cleared with ss_dec_clear when no longer needed
+//
+void ss_dec_init(SSDecCtx *ctx, const SSPriv *key);
+
+//
+// Frees the memory used by a decryption context.
+//
+void ss_dec_clear(SSDecCtx *ctx);
+
+//
+// Decrypt number c into number m with a prepared context. Gives the same result as
+// ss_decrypt_key.
+//
+// Provides:
+//  m: decrypted/original integer
+//
+// Requires:
+//  c: encrypted integer
+//  ctx: initialized with ss_dec_init
+//  all mpz_t arguments to be initialized
+//
+void ss_decrypt_ctx(mpz_t m, const mpz_t c, SSDecCtx *ctx);
+
+//
+// Decrypt a file back into its original form on several threads. Ciphertext blocks are parsed in
+// batches on the calling thread, decrypted on every thread of the pool, and written in their
+// original order. Both binary files and hexstring lines are accepted; binary files are
+// recognized by SS_MAGIC. Files starting with SS_HYBRID_MAGIC or SS_MULTI_MAGIC are decrypted as
+// by ss_decrypt_file_hybrid instead, on the calling thread.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  key: private key
+//  threads: number of threads to decrypt on, counting the calling thread
+//
+// Returns the number of plaintext bytes written.
+//
+uint64_t ss_decrypt_file_threads(FILE *infile, FILE *outfile, const SSPriv *key, int threads);
+
+//
+// Decrypt len bytes of plaintext starting at offset from a binary ciphertext file. Records are
+// fixed-width, so the records covering the range are located from the header alone: only those
+// are read and exponentiated, and the plaintext is trimmed to the range.
+//
+// Provides:
+//  fills outfile with up to len bytes of the original data from offset
+//
+// Requires:
+//  infile: open, readable and seekable file stream to a binary ciphertext file
+//  outfile: open and writable file stream
+//  key: private key
+//  threads: number of threads to decrypt on, counting the calling thread
+//
+// Returns the number of plaintext bytes written.
+//
+uint64_t ss_decrypt_file_range(FILE *infile, FILE *outfile, const SSPriv *key, int threads,
+    uint64_t offset, uint64_t len);
+
+//
+// Encrypt an arbitrary file in hybrid mode: a random ChaCha20 session key is encrypted once with
+// the public key, and the data itself is encrypted with ChaCha20 under the session key, so the
+// cost of SS is paid once per file instead of once per block.
+//
+// The output is SS_HYBRID_MAGIC, then little-endian the version, a reserved 16-bit field, the
+// width of n in bytes and the ChaCha20 nonce, then the encrypted session key as one width-byte
+// big-endian record, then the encrypted data, which is as long as the original, and last the
+// SS_HYBRID_TAG_SIZE byte Poly1305 tag of the header and encrypted data. The Poly1305 key is the
+// first half of ChaCha20 block 0, and the data is encrypted from block 1 on; the tag covers the
+// header and the data, each zero-padded to 16 bytes, then their lengths as 64-bit little-endian
+// numbers, as in the ChaCha20-Poly1305 construction of RFC 8439.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus, large enough that the session key is less than pq
+//
+// Returns the number of plaintext bytes encrypted.
+//
+uint64_t ss_encrypt_file_hybrid(FILE *infile, FILE *outfile, const mpz_t n);
+
+//
+// Fingerprint of a public key: the 64-bit FNV-1a hash of n in big-endian bytes. It tells keys
+// apart, but it is not a cryptographic hash.
+//
+// Provides:
+//  fingerprint: SS_FINGERPRINT_SIZE bytes identifying n
+//
+// Requires:
+//  n: public exponent and modulus
+//
+void ss_fingerprint(uint8_t *fingerprint, const mpz_t n);
+
+//
+// Encrypt an arbitrary file once for several recipients. The data is encrypted with ChaCha20 under
+// a random session key as in hybrid mode, and only the session key is encrypted with each public
+// key, so adding a recipient costs one exponentiation rather than a pass over the data.
+//
+// The output is SS_MULTI_MAGIC, then little-endian the version, a reserved 16-bit field, the
+// number of recipients and the ChaCha20 nonce. Each recipient follows as the fingerprint of their
+// key, the width of their n in bytes (little-endian, 32 bits), and the session key encrypted for
+// them as one width-byte big-endian record. The encrypted data and its tag come last, as in
+// ss_encrypt_file_hybrid.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: count public keys, each large enough for hybrid mode
+//  count: number of recipients, at least 1
+//
+// Returns the number of plaintext bytes encrypted.
+//
+uint64_t ss_encrypt_file_multi(FILE *infile, FILE *outfile, const mpz_t n[], uint32_t count);
+
+//
+// Decrypt a file written by ss_encrypt_file_hybrid or ss_encrypt_file_multi back into its
+// original form. In a multi-recipient file, the session key for this private key is found by the
+// fingerprint of n = p * pq; private keys without p have every recipient tried in turn.
+//
+// Exits if the tag does not match, so a file that was altered or cut short fails. When infile can
+// be seeked, the tag is checked before anything is written to outfile; otherwise the data is
+// decrypted as it is read and the error comes at the end.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to hybrid encrypted data
+//  outfile: open and writable file stream
+//  key: private key
+//
+// Returns the number of plaintext bytes written.
+//
+uint64_t ss_decrypt_file_hybrid(FILE *infile, FILE *outfile, const SSPriv *key);
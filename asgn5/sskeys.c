@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "keystore.h"
+#include "ss.h"
+
+// Print usage information.
+void print_help(void) {
+    printf("SYNOPSIS\n");
+    printf("   Builds a keystore holding many SS keys, or lists and looks up its keys.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./sskeys -o keystore [-p] name...\n");
+    printf("   ./sskeys -k keystore [-u username | -f fingerprint]");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -o keystore     Write a keystore with the keys name.pub and, if it exists,\n");
+    printf("                   name.priv for every name given, as written by keygen --batch.\n");
+    printf("   -p              Leave the private keys out of the keystore.\n");
+    printf("   -k keystore     List the keys of a keystore.\n");
+    printf("   -u username     Only list the key of username.\n");
+    printf("   -f fingerprint  Only list the key with this fingerprint, as printed by encrypt -v.\n");
+}
+
+// Parses a fingerprint of 2 * SS_FINGERPRINT_SIZE hex digits. Returns false if it is not one.
+static bool parse_fingerprint(const char *arg, uint8_t *fingerprint) {
+    if (strlen(arg) != 2 * SS_FINGERPRINT_SIZE
+        || strspn(arg, "0123456789abcdefABCDEF") != 2 * SS_FINGERPRINT_SIZE) {
+        return false;
+    }
+    for (int i = 0; i < SS_FINGERPRINT_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(arg + 2 * i, "%2x", &byte) != 1) {
+            return false;
+        }
+        fingerprint[i] = byte;
+    }
+    return true;
+}
+
+// Prints one line for record index: number, username, bits of n, fingerprint and what it holds.
+static void print_key(const Keystore *ks, uint32_t index) {
+    char username[KEYSTORE_NAME_SIZE];
+    uint8_t fingerprint[SS_FINGERPRINT_SIZE];
+    mpz_t n;
+    mpz_init(n);
+    SSPriv key;
+    ss_priv_init(&key);
+    keystore_username(ks, index, username);
+    keystore_fingerprint(ks, index, fingerprint);
+    keystore_pub(ks, index, n);
+    bool priv = keystore_priv(ks, index, &key);
+
+    printf("%" PRIu32 " %s %zu ", index, username, mpz_sizeinbase(n, 2));
+    for (int i = 0; i < SS_FINGERPRINT_SIZE; i++) {
+        printf("%02x", fingerprint[i]);
+    }
+    printf(" %s\n", !priv ? "public" : key.crt ? "private crt" : "private");
+    mpz_clear(n);
+    ss_priv_clear(&key);
+}
+
+// Writes a keystore to path with the keys name.pub and name.priv of count names.
+static int build(const char *path, char *names[], int count, bool public_only) {
+    KeystoreEntry *entries = (KeystoreEntry *) calloc(count + 1, sizeof(KeystoreEntry));
+    char(*usernames)[SS_USERNAME_SIZE] = calloc(count + 1, SS_USERNAME_SIZE);
+    mpz_t *n = (mpz_t *) malloc((count + 1) * sizeof(mpz_t));
+    SSPriv *keys = (SSPriv *) malloc((count + 1) * sizeof(SSPriv));
+    char *file = NULL;
+    if (entries == NULL || usernames == NULL || n == NULL || keys == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for keys.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < count; i++) {
+        mpz_init(n[i]);
+        ss_priv_init(&keys[i]);
+        size_t size = strlen(names[i]) + sizeof(".priv");
+        file = (char *) realloc(file, size);
+        if (file == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for keys.\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(file, size, "%s.pub", names[i]);
+        FILE *pbfile = fopen(file, "r");
+        if (!pbfile) {
+            fprintf(stderr, "Error: could not open public key file %s\n", file);
+            return 1;
+        }
+        ss_read_pub(n[i], usernames[i], pbfile);
+        fclose(pbfile);
+        entries[i].username = usernames[i];
+        entries[i].n = n[i];
+
+        // A missing private key file leaves the entry public
+        snprintf(file, size, "%s.priv", names[i]);
+        FILE *pvfile = public_only ? NULL : fopen(file, "r");
+        if (pvfile) {
+            if (!ss_read_priv_key(&keys[i], pvfile)) {
+                fprintf(stderr, "Error: invalid private key file %s\n", file);
+                return 1;
+            }
+            fclose(pvfile);
+            entries[i].key = &keys[i];
+        }
+    }
+
+    // Write to a temporary file next to path and rename it into place, so an existing keystore
+    // is only ever replaced by a complete one
+    size_t size = strlen(path) + sizeof(".tmp");
+    file = (char *) realloc(file, size);
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for keys.\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(file, size, "%s.tmp", path);
+    FILE *outfile = fopen(file, "w");
+    if (!outfile) {
+        fprintf(stderr, "Error: could not open output file %s\n", file);
+        return 1;
+    }
+    bool valid = keystore_write(outfile, entries, count);
+    valid = fclose(outfile) == 0 && valid;
+    if (valid && rename(file, path) != 0) {
+        fprintf(stderr, "Error: could not replace %s\n", path);
+        valid = false;
+    }
+    if (!valid) {
+        remove(file);
+    }
+
+    for (int i = 0; i < count; i++) {
+        mpz_clear(n[i]);
+        ss_priv_clear(&keys[i]);
+    }
+    free(entries);
+    free(usernames);
+    free(n);
+    free(keys);
+    free(file);
+    return valid ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    char *outpath = NULL;
+    char *kspath = NULL;
+    char *username = NULL;
+    char *fingerprint_arg = NULL;
+    bool public_only = false;
+
+    while ((opt = getopt(argc, argv, "ho:pk:u:f:")) != -1) {
+        switch (opt) {
+        case 'o': outpath = optarg; break;
+        case 'p': public_only = true; break;
+        case 'k': kspath = optarg; break;
+        case 'u': username = optarg; break;
+        case 'f': fingerprint_arg = optarg; break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+
+    if (outpath != NULL) {
+        return build(outpath, argv + optind, argc - optind, public_only);
+    }
+    if (kspath == NULL) {
+        print_help();
+        return 1;
+    }
+
+    Keystore *ks = keystore_open(kspath);
+    if (ks == NULL) {
+        return 1;
+    }
+    int status = 0;
+    if (username != NULL || fingerprint_arg != NULL) {
+        uint8_t fingerprint[SS_FINGERPRINT_SIZE];
+        uint32_t index = KEYSTORE_NOT_FOUND;
+        if (username != NULL) {
+            index = keystore_find(ks, username);
+        } else if (parse_fingerprint(fingerprint_arg, fingerprint)) {
+            index = keystore_find_fingerprint(ks, fingerprint);
+        } else {
+            fprintf(stderr, "Error: invalid fingerprint %s\n", fingerprint_arg);
+        }
+        if (index == KEYSTORE_NOT_FOUND) {
+            fprintf(stderr, "Error: no such key in %s\n", kspath);
+            status = 1;
+        } else {
+            print_key(ks, index);
+        }
+    } else {
+        for (uint32_t i = 0; i < keystore_count(ks); i++) {
+            print_key(ks, i);
+        }
+    }
+    keystore_close(ks);
+    return status;
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "../asgn6/stream.h"
+#include "profile.h"
+#include "ss.h"
+
+#define IO_BUFFER_SIZE   (1 << 20)
+#define PIPE_BUFFER_SIZE (1 << 20) // Bytes one stage may run ahead of the other.
+
+// Print usage information.
+void print_help(void) {
+    printf("SYNOPSIS\n");
+    printf("   Compresses data with LZ78 and encrypts it with SS in one pass, or decrypts\n");
+    printf("   and decompresses it again. Each stage runs on its own thread.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./sspipe [OPTIONS]");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   -d              Decrypt and decompress instead of compressing and encrypting.\n");
+    printf("   -i infile       Input file (default: stdin).\n");
+    printf("   -o outfile      Output file (default: stdout).\n");
+    printf("   -n keyfile      Public key file, or private key file with -d\n");
+    printf("                   (default: ss.pub, or ss.priv with -d).\n");
+    printf("   -j threads      Number of threads to encrypt or decrypt on (default: 1).\n");
+    printf("   -H              Hybrid mode: encrypt a session key with SS and the data with\n");
+    printf("                   ChaCha20 (needs a key of at least 529 bits).\n");
+}
+
+// Reads the public key n from the file at path. Returns false and prints an error if the file
+// cannot be read.
+static bool read_pub(const char *path, mpz_t n) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: could not open public key file %s\n", path);
+        return false;
+    }
+    char *hex_key = NULL;
+    size_t hex_key_size = 0;
+    bool valid = getline(&hex_key, &hex_key_size, f) != -1 && mpz_set_str(n, hex_key, 16) != -1;
+    free(hex_key);
+    fclose(f);
+    if (!valid) {
+        fprintf(stderr, "Error: invalid public key file format\n");
+        return false;
+    }
+    return true;
+}
+
+// Reads the private key from the file at path. Returns false and prints an error if the file
+// cannot be read.
+static bool read_priv(const char *path, SSPriv *key) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: could not open private key file %s\n", path);
+        return false;
+    }
+    bool valid = ss_read_priv_key(key, f) && mpz_cmp_ui(key->pq, 0) != 0
+                 && mpz_cmp_ui(key->d, 0) != 0;
+    fclose(f);
+    if (!valid) {
+        fprintf(stderr, "Error: invalid private key file format\n");
+        return false;
+    }
+    return true;
+}
+
+// The stage that runs on its own thread, reading from in and writing to out. It closes out when it
+// is done, which is how the stage after it sees the end of its input.
+typedef struct Stage {
+    int in;
+    int out;
+    uint16_t protection; // compress: mode bits stored in the LZ78 header
+    const SSPriv *key; // decrypt: private key
+    int threads;
+    bool hybrid;
+    uint64_t bytes; // bytes the stage read
+    bool valid; // compress: the dictionary could be allocated
+} Stage;
+
+static void *compress_stage(void *arg) {
+    Stage *stage = (Stage *) arg;
+    stage->valid = compress_stream(stage->in, stage->out, stage->protection, &stage->bytes);
+    close(stage->out);
+    return NULL;
+}
+
+static void *decrypt_stage(void *arg) {
+    Stage *stage = (Stage *) arg;
+    FILE *infile = fdopen(stage->in, "r");
+    FILE *outfile = fdopen(stage->out, "w");
+    if (!infile || !outfile) {
+        fprintf(stderr, "Error: could not open decrypt stage streams\n");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(infile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    setvbuf(outfile, NULL, _IOFBF, IO_BUFFER_SIZE);
+    if (stage->hybrid) {
+        stage->bytes = ss_decrypt_file_hybrid(infile, outfile, stage->key);
+    } else {
+        stage->bytes = ss_decrypt_file_threads(infile, outfile, stage->key, stage->threads);
+    }
+    fclose(outfile);
+    return NULL;
+}
+
+// Creates the pipe between the two stages. The kernel buffers at most PIPE_BUFFER_SIZE bytes in
+// it, so a fast stage blocks rather than running ahead of a slow one without bound.
+static void make_pipe(int fds[2]) {
+    if (pipe(fds) != 0) {
+        perror("Failed to create pipe");
+        exit(EXIT_FAILURE);
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int infile = STDIN_FILENO;
+    int outfile = STDOUT_FILENO;
+    char *keyfile = NULL;
+    bool verbose = false;
+    bool decrypt = false;
+    bool hybrid = false;
+    int threads = 1;
+
+    while ((opt = getopt(argc, argv, "hvdi:o:n:j:H")) != -1) {
+        switch (opt) {
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (infile == -1) {
+                fprintf(stderr, "Error: could not open input file %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            outfile = open(optarg, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+            if (outfile == -1) {
+                fprintf(stderr, "Error: could not open output file %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n': keyfile = optarg; break;
+        case 'v': verbose = true; break;
+        case 'd': decrypt = true; break;
+        case 'H': hybrid = true; break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Error: number of threads must be positive\n");
+                return 1;
+            }
+            break;
+        case 'h': print_help(); return 0;
+        default: print_help(); return 1;
+        }
+    }
+    if (keyfile == NULL) {
+        keyfile = decrypt ? "ss.priv" : "ss.pub";
+    }
+
+    // A stage that stops reading early must make the one writing to it fail, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    mpz_t n;
+    mpz_init(n);
+    SSPriv key;
+    ss_priv_init(&key);
+    if (decrypt ? !read_priv(keyfile, &key) : !read_pub(keyfile, n)) {
+        return 1;
+    }
+
+    int fds[2];
+    make_pipe(fds);
+    Stage stage = { 0 };
+    stage.threads = threads;
+    stage.hybrid = hybrid;
+    pthread_t thread;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bytes = 0; // bytes read by the stage on this thread
+    bool valid = true;
+
+    if (!decrypt) {
+        // infile -> compress thread -> pipe -> encrypt on this thread -> outfile
+        struct stat stats;
+        stage.in = infile;
+        stage.out = fds[1];
+        stage.protection = fstat(infile, &stats) == 0 ? stats.st_mode : 0644;
+        pthread_create(&thread, NULL, compress_stage, &stage);
+
+        FILE *in = fdopen(fds[0], "r");
+        FILE *out = fdopen(outfile, "w");
+        if (!in || !out) {
+            fprintf(stderr, "Error: could not open encrypt stage streams\n");
+            return 1;
+        }
+        setvbuf(in, NULL, _IOFBF, IO_BUFFER_SIZE);
+        setvbuf(out, NULL, _IOFBF, IO_BUFFER_SIZE);
+        if (hybrid) {
+            bytes = ss_encrypt_file_hybrid(in, out, n);
+        } else {
+            bytes = ss_encrypt_file_threads(in, out, n, threads, true);
+        }
+        fclose(in);
+        fclose(out);
+        pthread_join(thread, NULL);
+        valid = stage.valid;
+        if (!valid) {
+            fprintf(stderr, "Error: could not compress input\n");
+        }
+    } else {
+        // infile -> decrypt thread -> pipe -> decompress on this thread -> outfile
+        stage.in = infile;
+        stage.out = fds[1];
+        stage.key = &key;
+        pthread_create(&thread, NULL, decrypt_stage, &stage);
+
+        valid = decompress_stream(fds[0], outfile, &bytes);
+        close(fds[0]);
+        pthread_join(thread, NULL);
+        close(outfile);
+        if (!valid) {
+            fprintf(stderr, "Error: decrypted data is not LZ78 compressed\n");
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Report sizes and throughput on stderr, so they do not end up in the output on stdout
+    if (verbose && valid) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        uint64_t plain = decrypt ? bytes : stage.bytes;
+        uint64_t compressed = decrypt ? stage.bytes : bytes;
+        fprintf(stderr,
+            "%s %" PRIu64 " bytes (%" PRIu64 " compressed) in %.3f s (%.2f MB/s, %zu-bit key)\n",
+            decrypt ? "Decrypted and decompressed" : "Compressed and encrypted", plain, compressed,
+            seconds, seconds > 0 ? plain / seconds / 1e6 : 0.0,
+            mpz_sizeinbase(decrypt ? key.pq : n, 2));
+        profile_report(stderr);
+    }
+
+    mpz_clear(n);
+    ss_priv_clear(&key);
+    return valid ? 0 : 1;
+}
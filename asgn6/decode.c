@@ -19,6 +19,7 @@
 #include "io.h"
 #include "code.h"
 #include "endian.h"
+#include "stream.h"
 
 void print_help(void);
 int bit_length(uint16_t n);
@@ -53,39 +54,23 @@ int main(int argc, char *argv[]) {
     }
 
     int compressed_size = 0;
-    int uncompressed_size = 0;
+    uint64_t uncompressed_size = 0;
     float compression_ratio = 0.0;
 
-    struct stat stats;
-    Word *w = malloc(sizeof(Word)); // change to allocate memory for Word
-    fstat(outfile, &stats);
-    w->syms = NULL; // initialize syms to NULL
-    w->len = stats.st_size; // update len to file size
-
-    WordTable *table = wt_create();
-    uint8_t curr_sym = 0;
-    uint16_t curr_code = 0;
-    uint16_t next_code = START_CODE;
-
-    while (read_pair(infile, &curr_code, &curr_sym, bit_length(next_code)) == true) {
-        table[next_code] = word_append_sym(table[curr_code], curr_sym);
-        write_word(outfile, table[next_code]);
-        // uncompressed_size += table[next_code]->len;
-        // compressed_size += bit_length(next_code) / 8;
-        next_code++;
-        if ((next_code == MAX_CODE) == true) {
-            wt_reset(table);
-            next_code = START_CODE;
-        }
+    if (decompress_stream(infile, outfile, &uncompressed_size) == false) {
+        fprintf(stderr, "Input is not a compressed file\n");
+        return 1;
     }
-    flush_words(outfile);
-    wt_delete(table);
 
-    compression_ratio = (100.0 * (1.0 - (compressed_size / uncompressed_size)));
+    compressed_size = lseek(infile, 0, SEEK_CUR);
+    if (uncompressed_size > 0 && compressed_size > 0) {
+        compression_ratio
+            = (100.0 * (1.0 - ((float) compressed_size / (float) uncompressed_size)));
+    }
 
     if (verbose == true) {
         printf("Compressed file size: %d bytes\n", compressed_size);
-        printf("Uncompressed file size: %d bytes\n", uncompressed_size);
+        printf("Uncompressed file size: %" PRIu64 " bytes\n", uncompressed_size);
         printf("Compression ratio: %2.2f%%\n", compression_ratio);
     }
 
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decompress.h"
+#include "io.h"
+#include "code.h"
+#include "endian.h"
+
+// Where each code's word starts in the output buffer, and how long it is.
+typedef struct Entry {
+    uint64_t start;
+    uint32_t len;
+} Entry;
+
+static int bit_length(uint16_t n) {
+    int length = 0;
+    while (n > 0) {
+        length++;
+        n >>= 1;
+    }
+    return length;
+}
+
+// Read the header at byte offset pos of in into *header. Return false if there is no segment there.
+static bool buffer_header(const uint8_t *in, size_t in_len, uint64_t pos, FileHeader *header) {
+    if (pos + sizeof(FileHeader) > in_len) {
+        return false;
+    }
+    memcpy(header, in + pos, sizeof(FileHeader));
+    if (big_endian()) {
+        header->magic = swap32(header->magic);
+        header->size = swap64(header->size);
+    }
+    return header->magic == MAGIC;
+}
+
+// Read bitlen bits starting at bit pos of in, least significant bit first, advancing pos.
+static bool buffer_bits(const uint8_t *in, size_t in_len, uint64_t *pos, int bitlen, uint32_t *v) {
+    if (*pos + bitlen > (uint64_t) in_len * 8) {
+        return false;
+    }
+    *v = 0;
+    int got = 0;
+    while (got < bitlen) {
+        int offset = *pos & 7;
+        int take = 8 - offset < bitlen - got ? 8 - offset : bitlen - got;
+        *v |= (uint32_t) ((in[*pos >> 3] >> offset) & ((1 << take) - 1)) << got;
+        got += take;
+        *pos += take;
+    }
+    return true;
+}
+
+int decompressed_size(const uint8_t *in, size_t in_len, uint64_t *size) {
+    FileHeader header;
+    if (buffer_header(in, in_len, 0, &header) == false) {
+        return DECOMPRESS_BAD_MAGIC;
+    }
+
+    // A single segment carries the total; several are found through the trailing segment table
+    SegmentTrailer trailer = { 0, 0, 0 };
+    if (in_len >= sizeof(SegmentTrailer)) {
+        memcpy(&trailer, in + in_len - sizeof(SegmentTrailer), sizeof(SegmentTrailer));
+        if (big_endian()) {
+            trailer.offset = swap64(trailer.offset);
+            trailer.count = swap32(trailer.count);
+            trailer.magic = swap32(trailer.magic);
+        }
+    }
+    if (trailer.magic != INDEX_MAGIC) {
+        *size = header.size;
+        return header.size != SIZE_UNKNOWN ? DECOMPRESS_OK : DECOMPRESS_UNKNOWN_SIZE;
+    }
+
+    uint64_t table = trailer.offset + 2 * sizeof(uint32_t);
+    if (table + (uint64_t) trailer.count * sizeof(uint64_t) > in_len) {
+        return DECOMPRESS_CORRUPT;
+    }
+    *size = 0;
+    for (uint32_t i = 0; i < trailer.count; i++) {
+        uint64_t offset;
+        memcpy(&offset, in + table + i * sizeof(uint64_t), sizeof(offset));
+        if (big_endian()) {
+            offset = swap64(offset);
+        }
+        if (buffer_header(in, in_len, offset, &header) == false) {
+            return DECOMPRESS_CORRUPT;
+        }
+        if (header.size == SIZE_UNKNOWN) {
+            return DECOMPRESS_UNKNOWN_SIZE;
+        }
+        *size += header.size;
+    }
+    return DECOMPRESS_OK;
+}
+
+int decompress_buffer(
+    const uint8_t *in, size_t in_len, uint8_t *out, uint64_t out_len, uint64_t *written) {
+    *written = 0;
+
+    FileHeader header;
+    if (buffer_header(in, in_len, 0, &header) == false) {
+        return DECOMPRESS_BAD_MAGIC;
+    }
+
+    Entry *table = (Entry *) malloc((MAX_CODE + 1) * sizeof(Entry));
+    if (table == NULL) {
+        return DECOMPRESS_NO_MEMORY;
+    }
+
+    int status = DECOMPRESS_OK;
+    uint64_t pos = sizeof(FileHeader) * 8;
+    uint64_t out_pos = 0;
+    uint16_t next_code = START_CODE;
+    table[EMPTY_CODE].start = 0;
+    table[EMPTY_CODE].len = 0;
+
+    // Same loop as decode, with words referring back into out instead of being copied into a table
+    while (true) {
+        uint32_t code, sym;
+        int bitlen = bit_length(next_code);
+        if (buffer_bits(in, in_len, &pos, bitlen, &code) == false
+            || buffer_bits(in, in_len, &pos, 8, &sym) == false) {
+            status = DECOMPRESS_CORRUPT;
+            break;
+        }
+
+        if (code == STOP_CODE) {
+            // Segments start on a byte boundary and each one starts a fresh dictionary
+            pos = (pos + 7) & ~(uint64_t) 7;
+            if (buffer_header(in, in_len, pos >> 3, &header) == false) {
+                break;
+            }
+            pos += sizeof(FileHeader) * 8;
+            next_code = START_CODE;
+            continue;
+        }
+
+        if (code != EMPTY_CODE && code >= next_code) {
+            status = DECOMPRESS_CORRUPT;
+            break;
+        }
+        uint32_t len = table[code].len + 1;
+        if (out_pos + len > out_len) {
+            status = DECOMPRESS_OVERFLOW;
+            break;
+        }
+        memcpy(out + out_pos, out + table[code].start, len - 1);
+        out[out_pos + len - 1] = sym;
+        table[next_code].start = out_pos;
+        table[next_code].len = len;
+        out_pos += len;
+
+        next_code++;
+        if (next_code == MAX_CODE) {
+            next_code = START_CODE;
+        }
+    }
+
+    free(table);
+    *written = out_pos;
+    return status;
+}
@@ -0,0 +1,35 @@
+#ifndef __DECOMPRESS_H__
+#define __DECOMPRESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DECOMPRESS_OK           0 // The whole input was decompressed.
+#define DECOMPRESS_BAD_MAGIC    1 // The input does not start with a file header.
+#define DECOMPRESS_CORRUPT      2 // The input ends early or refers to a code not yet defined.
+#define DECOMPRESS_OVERFLOW     3 // The output buffer is too small.
+#define DECOMPRESS_NO_MEMORY    4 // The word table could not be allocated.
+#define DECOMPRESS_UNKNOWN_SIZE 5 // The headers do not record the uncompressed size.
+
+//
+// Store the uncompressed size of the compressed data in in[0 .. in_len) into *size, taken from the
+// segment headers without decompressing anything. Return a DECOMPRESS_* status.
+//
+// encode records the size of each segment when its output is seekable, so an empty input is known
+// to be 0 bytes. Output written to a pipe leaves it at SIZE_UNKNOWN, which is reported as
+// DECOMPRESS_UNKNOWN_SIZE.
+//
+int decompressed_size(const uint8_t *in, size_t in_len, uint64_t *size);
+
+//
+// Decompress every segment of in[0 .. in_len) into out, which holds out_len bytes. The number of
+// bytes written is stored in *written. Return a DECOMPRESS_* status.
+//
+// No file descriptors or global buffers are involved, so this may be called from several threads
+// at once. Each word is copied out of the bytes already written to out rather than kept in a Word
+// table, so the only allocation is one code table per call.
+//
+int decompress_buffer(
+    const uint8_t *in, size_t in_len, uint8_t *out, uint64_t out_len, uint64_t *written);
+
+#endif
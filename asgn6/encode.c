@@ -19,20 +19,44 @@
 #include "io.h"
 #include "code.h"
 #include "endian.h"
+#include "stream.h"
 
-int bit_length(uint8_t n);
+uint64_t parse_size(const char *arg);
 void print_help(void);
 
+static struct option long_options[] = {
+    { "append", required_argument, NULL, 'a' },
+    { "memory", required_argument, NULL, 'M' },
+    { NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char *argv[]) {
     int opt;
     int infile = STDIN_FILENO; // Default input
     int outfile = STDOUT_FILENO; // Default output
     bool verbose = false;
+    bool append = false;
+    uint64_t memory = 0;
     setlocale(LC_ALL, "");
 
-    while ((opt = getopt(argc, argv, "vh i: o:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "vh i: o: a: M:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'v': verbose = true; break;
+        case 'a':
+            outfile = open(optarg, O_CREAT | O_RDWR, 0666);
+            if (outfile == -1) {
+                perror("Failed to open append file");
+                return 1;
+            }
+            append = true;
+            break;
+        case 'M':
+            memory = parse_size(optarg);
+            if (memory == 0) {
+                fprintf(stderr, "Invalid memory cap %s\n", optarg);
+                return 1;
+            }
+            break;
         case 'i':
             infile = open(optarg, O_RDONLY);
             if (infile == -1) {
@@ -58,62 +82,55 @@ int main(int argc, char *argv[]) {
     fstat(outfile, &stats);
     file_header.magic = MAGIC;
     file_header.protection = stats.st_mode;
+    file_header.reserved = 0;
+    file_header.size = SIZE_UNKNOWN;
+
+    // In append mode the new segment replaces the old segment table, which is rewritten after it
+    SegmentTable table = { NULL, 0, 0 };
+    off_t output_start = lseek(outfile, 0, SEEK_CUR);
+    if (append == true) {
+        uint64_t end = 0;
+        if (read_index(outfile, &table.offsets, &table.count, &end) == false) {
+            fprintf(stderr, "Append file is not a compressed file\n");
+            return 1;
+        }
+        table.capacity = table.count;
+        output_start = lseek(outfile, end, SEEK_SET);
+    }
 
     int compressed_size = 0;
-    int uncompressed_size = 0;
+    uint64_t uncompressed_size = 0;
     float compression_ratio = 0.0;
 
-    TrieNode *root = trie_create();
-    TrieNode *curr_node = root;
-    TrieNode *prev_node = NULL;
-    uint8_t curr_sym = 0;
-    uint8_t prev_sym = 0;
-    uint16_t next_code = START_CODE;
-
-    write_header(outfile, &file_header);
-
-    while (read_sym(infile, &curr_sym) == true) {
-        TrieNode *next_node = trie_step(curr_node, curr_sym);
-        if (next_node != NULL) {
-            prev_node = curr_node;
-            curr_node = next_node;
-        } else {
-            write_pair(outfile, curr_node->code, curr_sym, bit_length(next_code));
-            curr_node->children[curr_sym] = trie_node_create(next_code);
-            curr_node = root;
-            next_code++;
-        }
-        if (next_code == MAX_CODE) {
-            trie_reset(root);
-            curr_node = root;
-            next_code = START_CODE;
-        }
-        prev_sym = curr_sym;
-        uncompressed_size++;
-    }
-    if (curr_node != root) {
-        write_pair(outfile, prev_node->code, prev_sym, bit_length(next_code));
-        next_code++;
-        next_code %= MAX_CODE;
+    if (compress_segments(infile, outfile, &file_header, memory, &table, &uncompressed_size)
+        == false) {
+        return 1;
     }
-    write_pair(outfile, STOP_CODE, 0, bit_length(next_code));
-    flush_pairs(outfile);
 
-    compressed_size = lseek(outfile, 0, SEEK_CUR);
-    lseek(outfile, 0, SEEK_SET);
+    // Output to a pipe needs no segment table to be decoded
+    if (output_start != -1) {
+        compressed_size = lseek(outfile, 0, SEEK_CUR) - output_start;
 
-    if (compressed_size == -1) {
-        perror("Failed to determine compressed file size");
-        return 1;
+        // Files with more than one segment get a segment table so they can be appended to
+        if (append == true || table.count > 1) {
+            write_index(outfile, table.offsets, table.count);
+            if (ftruncate(outfile, lseek(outfile, 0, SEEK_CUR)) != 0) {
+                perror("Failed to truncate append file");
+                return 1;
+            }
+        }
     }
+    free(table.offsets);
+    lseek(outfile, 0, SEEK_SET);
 
-    trie_delete(root);
-
-    compression_ratio = (100.0 * (1.0 - ((float) compressed_size / (float) uncompressed_size)));
+    if (uncompressed_size > 0) {
+        compression_ratio
+            = (100.0 * (1.0 - ((float) compressed_size / (float) uncompressed_size)));
+    }
 
     if (verbose == true) {
         printf("Compressed file size: %d bytes\n", compressed_size);
-        printf("Uncompressed file size: %d bytes\n", uncompressed_size);
+        printf("Uncompressed file size: %" PRIu64 " bytes\n", uncompressed_size);
         printf("Compression ratio: %2.2f%%\n", compression_ratio);
     }
 
@@ -130,20 +147,33 @@ void print_help(void) {
     printf("   Compressed files are decompressed with the corresponding decoder.\n");
     printf("\n");
     printf("USAGE\n");
-    printf("   ./encode [-vh] [-i input] [-o output]");
+    printf("   ./encode [-vh] [-i input] [-o output | -a file]");
     printf("\n");
     printf("OPTIONS\n");
     printf("   -v          Display compression statistics\n");
     printf("   -i input    Specify input to compress (stdin by default)\n");
     printf("   -o output   Specify output of compressed input (stdout by default)\n");
+    printf("   -a file     Append input as a new segment of compressed file (--append)\n");
+    printf("   -M size     Cap dictionary memory, e.g. 16M (--memory, unbounded by default)\n");
     printf("   -h          Display program help and usage\n");
 }
 
-int bit_length(uint8_t n) {
-    int length = 0;
-    while (n > 0) {
-        length++;
-        n >>= 1;
+// Parse a byte count with an optional K, M or G suffix. Returns 0 if arg is not a valid size.
+uint64_t parse_size(const char *arg) {
+    char *end = NULL;
+    uint64_t size = strtoull(arg, &end, 10);
+    if (end == arg) {
+        return 0;
+    }
+    switch (*end) {
+    case '\0': return size;
+    case 'K':
+    case 'k': size <<= 10; break;
+    case 'M':
+    case 'm': size <<= 20; break;
+    case 'G':
+    case 'g': size <<= 30; break;
+    default: return 0;
     }
-    return length;
+    return end[1] == '\0' ? size : 0;
 }
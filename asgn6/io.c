@@ -25,6 +25,8 @@ uint64_t total_bits = 0;
 static uint8_t buffer[BLOCK];
 static uint8_t buf[BLOCK];
 static int nextbit = 0;
+static int pair_index = 0; // Next bit of buf to be read by read_pair.
+static int pair_nbytes = 0; // Number of valid bytes in buf for read_pair.
 
 //
 // Read up to to_read bytes from infile and store them in buf. Return the number of bytes actually
@@ -95,9 +97,11 @@ void read_header(int infile, FileHeader *header) {
         // Handle error
     }
 
-    // Swap endianness of the magic field if necessary
+    // Swap endianness of the fields if necessary
     if (big_endian()) {
         header->magic = swap32(header->magic);
+        header->protection = swap16(header->protection);
+        header->size = swap64(header->size);
     }
 
     // Verify the magic number
@@ -115,6 +119,7 @@ void write_header(int outfile, FileHeader *header) {
     if (big_endian()) {
         header->magic = swap32(header->magic);
         header->protection = swap16(header->protection);
+        header->size = swap64(header->size);
     }
 
     // Write sizeof(FileHeader) bytes to the output file from the header
@@ -223,15 +228,10 @@ void flush_pairs(int outfile) {
 // It may be useful to write a helper function that reads a single bit from a file using a buffer.
 //
 bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
-    static int index = 0;
-    static int bits_read = 0;
-    static int nbytes = 0;
-
-    if (bits_read >= nbytes * 8) {
-        nbytes = read_bytes(infile, buf, BLOCK);
-        index = 0;
-        bits_read = 0;
-        if (nbytes <= 0) {
+    if (pair_index >= pair_nbytes * 8) {
+        pair_nbytes = read_bytes(infile, buf, BLOCK);
+        pair_index = 0;
+        if (pair_nbytes <= 0) {
             return false;
         }
     }
@@ -239,44 +239,41 @@ bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
     *code = 0;
     int bits_left = bitlen;
     while (bits_left > 0) {
-        if (bits_read >= nbytes * 8) {
-            nbytes = read_bytes(infile, buf, BLOCK);
-            index = 0;
-            bits_read = 0;
-            if (nbytes <= 0) {
+        if (pair_index >= pair_nbytes * 8) {
+            pair_nbytes = read_bytes(infile, buf, BLOCK);
+            pair_index = 0;
+            if (pair_nbytes <= 0) {
                 return false;
             }
         }
         int bits_to_read = bits_left;
-        if (bits_to_read > 8 - (index % 8)) {
-            bits_to_read = 8 - (index % 8);
+        if (bits_to_read > 8 - (pair_index % 8)) {
+            bits_to_read = 8 - (pair_index % 8);
         }
-        *code |= ((uint16_t) (buf[index / 8] >> (index % 8)) & ((1 << bits_to_read) - 1))
+        *code |= ((uint16_t) (buf[pair_index / 8] >> (pair_index % 8)) & ((1 << bits_to_read) - 1))
                  << (bitlen - bits_left);
-        index += bits_to_read;
+        pair_index += bits_to_read;
         bits_left -= bits_to_read;
-        bits_read += bits_to_read;
     }
 
     *sym = 0;
     bits_left = 8;
     while (bits_left > 0) {
-        if (bits_read >= nbytes * 8) {
-            nbytes = read_bytes(infile, buf, BLOCK);
-            index = 0;
-            bits_read = 0;
-            if (nbytes <= 0) {
+        if (pair_index >= pair_nbytes * 8) {
+            pair_nbytes = read_bytes(infile, buf, BLOCK);
+            pair_index = 0;
+            if (pair_nbytes <= 0) {
                 return false;
             }
         }
         int bits_to_read = bits_left;
-        if (bits_to_read > 8 - (index % 8)) {
-            bits_to_read = 8 - (index % 8);
+        if (bits_to_read > 8 - (pair_index % 8)) {
+            bits_to_read = 8 - (pair_index % 8);
         }
-        *sym |= (buf[index / 8] >> (index % 8)) & ((1 << bits_to_read) - 1) << (8 - bits_left);
-        index += bits_to_read;
+        *sym |= ((buf[pair_index / 8] >> (pair_index % 8)) & ((1 << bits_to_read) - 1))
+                << (8 - bits_left);
+        pair_index += bits_to_read;
         bits_left -= bits_to_read;
-        bits_read += bits_to_read;
     }
 
     return (*code != STOP_CODE);
@@ -329,3 +326,155 @@ void flush_words(int outfile) {
         buffer_pos = 0; // reset buffer position to start over
     }
 }
+
+//
+// Skip to the next byte boundary in read_pair's buffer and read the header of the next segment
+// into *header. Return true if a segment follows, false at the segment table or end of file.
+//
+// Every segment ends with a STOP_CODE pair flushed to a whole byte, so this is how decode moves on
+// to the segment that follows. It must also be used for the first header of a file, since the
+// segments after it are read out of the same buffer.
+//
+bool read_segment(int infile, FileHeader *header) {
+    uint8_t *bytes = (uint8_t *) header;
+    pair_index = (pair_index + 7) & ~7;
+
+    // The segment table starts with a 4-byte magic, so read that much before deciding
+    for (size_t i = 0; i < sizeof(FileHeader); i++) {
+        if (pair_index >= pair_nbytes * 8) {
+            pair_nbytes = read_bytes(infile, buf, BLOCK);
+            pair_index = 0;
+            if (pair_nbytes <= 0) {
+                return false;
+            }
+        }
+        bytes[i] = buf[pair_index / 8];
+        pair_index += 8;
+        if (i == sizeof(header->magic) - 1) {
+            uint32_t magic = header->magic;
+            if (big_endian()) {
+                magic = swap32(magic);
+            }
+            if (magic != MAGIC) {
+                return false;
+            }
+        }
+    }
+
+    if (big_endian()) {
+        header->magic = swap32(header->magic);
+        header->protection = swap16(header->protection);
+        header->size = swap64(header->size);
+    }
+    return true;
+}
+
+//
+// Read the segment table of the compressed file open in fd. On success *offsets holds the byte
+// offsets of the *count existing segments (allocated with malloc, freed by the caller) and *end is
+// the offset just past the last segment, which is where a new segment is written.
+//
+// Files without a segment table are a single segment at offset 0, and an empty file has none.
+// Return false if fd does not hold a compressed file.
+//
+bool read_index(int fd, uint64_t **offsets, uint32_t *count, uint64_t *end) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        return false;
+    }
+
+    *offsets = NULL;
+    *count = 0;
+    *end = 0;
+    if (size == 0) {
+        return true;
+    }
+
+    // Check for a segment table, falling back to a plain single-segment file
+    SegmentTrailer trailer = { 0, 0, 0 };
+    if (size >= (off_t) sizeof(SegmentTrailer)) {
+        lseek(fd, size - sizeof(SegmentTrailer), SEEK_SET);
+        read_bytes(fd, (uint8_t *) &trailer, sizeof(SegmentTrailer));
+        if (big_endian()) {
+            trailer.offset = swap64(trailer.offset);
+            trailer.count = swap32(trailer.count);
+            trailer.magic = swap32(trailer.magic);
+        }
+    }
+
+    if (trailer.magic != INDEX_MAGIC) {
+        uint32_t magic = 0;
+        lseek(fd, 0, SEEK_SET);
+        if (read_bytes(fd, (uint8_t *) &magic, sizeof(magic)) != sizeof(magic)) {
+            return false;
+        }
+        if (big_endian()) {
+            magic = swap32(magic);
+        }
+        if (magic != MAGIC) {
+            return false;
+        }
+        *offsets = (uint64_t *) malloc(sizeof(uint64_t));
+        (*offsets)[0] = 0;
+        *count = 1;
+        *end = size;
+        return true;
+    }
+
+    // The table repeats the magic and count ahead of the offsets
+    uint32_t table[2];
+    uint64_t table_size = 2 * sizeof(uint32_t) + trailer.count * sizeof(uint64_t);
+    if (trailer.offset + table_size + sizeof(SegmentTrailer) != (uint64_t) size) {
+        return false;
+    }
+    lseek(fd, trailer.offset, SEEK_SET);
+    read_bytes(fd, (uint8_t *) table, sizeof(table));
+    if (big_endian()) {
+        table[0] = swap32(table[0]);
+        table[1] = swap32(table[1]);
+    }
+    if (table[0] != INDEX_MAGIC || table[1] != trailer.count) {
+        return false;
+    }
+
+    *offsets = (uint64_t *) malloc(trailer.count * sizeof(uint64_t));
+    int nbytes = trailer.count * sizeof(uint64_t);
+    if (read_bytes(fd, (uint8_t *) *offsets, nbytes) != nbytes) {
+        free(*offsets);
+        *offsets = NULL;
+        return false;
+    }
+    if (big_endian()) {
+        for (uint32_t i = 0; i < trailer.count; i++) {
+            (*offsets)[i] = swap64((*offsets)[i]);
+        }
+    }
+    *count = trailer.count;
+    *end = trailer.offset;
+    return true;
+}
+
+//
+// Write the segment table and trailer for count segments at offsets to outfile at its current
+// offset.
+//
+void write_index(int outfile, uint64_t *offsets, uint32_t count) {
+    off_t start = lseek(outfile, 0, SEEK_CUR);
+    uint32_t table[2] = { INDEX_MAGIC, count };
+    SegmentTrailer trailer = { start, count, INDEX_MAGIC };
+
+    if (big_endian()) {
+        table[0] = swap32(table[0]);
+        table[1] = swap32(table[1]);
+        trailer.offset = swap64(trailer.offset);
+        trailer.count = swap32(trailer.count);
+        trailer.magic = swap32(trailer.magic);
+    }
+    write_bytes(outfile, (uint8_t *) table, sizeof(table));
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t offset = big_endian() ? swap64(offsets[i]) : offsets[i];
+        write_bytes(outfile, (uint8_t *) &offset, sizeof(offset));
+    }
+    write_bytes(outfile, (uint8_t *) &trailer, sizeof(trailer));
+}
@@ -7,6 +7,8 @@
 
 #define BLOCK 4096 // 4KB blocks.
 #define MAGIC 0xBAADBAAC // Unique encoder/decoder magic number.
+#define INDEX_MAGIC 0xBAADB10C // Magic number of the trailing segment index.
+#define SIZE_UNKNOWN UINT64_MAX // Segment size recorded when the uncompressed size is not known.
 
 extern uint64_t total_syms; // To count the symbols processed.
 extern uint64_t total_bits; // To count the bits processed.
@@ -14,8 +16,21 @@ extern uint64_t total_bits; // To count the bits processed.
 typedef struct FileHeader {
     uint32_t magic;
     uint16_t protection;
+    uint16_t reserved;
+    uint64_t size; // Uncompressed size of the segment, or SIZE_UNKNOWN.
 } FileHeader;
 
+//
+// Fixed-size record at the very end of a file with more than one segment. offset is the byte
+// offset of the segment table, which holds INDEX_MAGIC, count, and then count 64-bit segment
+// offsets. All fields are little-endian like the file header.
+//
+typedef struct SegmentTrailer {
+    uint64_t offset;
+    uint32_t count;
+    uint32_t magic;
+} SegmentTrailer;
+
 //
 // Read up to to_read bytes from infile and store them in buf. Return the number of bytes actually
 // read.
@@ -138,4 +153,30 @@ void write_word(int outfile, Word *w);
 //
 void flush_words(int outfile);
 
+//
+// Skip to the next byte boundary in read_pair's buffer and read the header of the next segment
+// into *header. Return true if a segment follows, false at the segment table or end of file.
+//
+// Every segment ends with a STOP_CODE pair flushed to a whole byte, so this is how decode moves on
+// to the segment that follows. It must also be used for the first header of a file, since the
+// segments after it are read out of the same buffer.
+//
+bool read_segment(int infile, FileHeader *header);
+
+//
+// Read the segment table of the compressed file open in fd. On success *offsets holds the byte
+// offsets of the *count existing segments (allocated with malloc, freed by the caller) and *end is
+// the offset just past the last segment, which is where a new segment is written.
+//
+// Files without a segment table are a single segment at offset 0, and an empty file has none.
+// Return false if fd does not hold a compressed file.
+//
+bool read_index(int fd, uint64_t **offsets, uint32_t *count, uint64_t *end);
+
+//
+// Write the segment table and trailer for count segments at offsets to outfile at its current
+// offset.
+//
+void write_index(int outfile, uint64_t *offsets, uint32_t count);
+
 #endif
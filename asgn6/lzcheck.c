@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "endian.h"
+#include "decompress.h"
+
+// Read all of path into a buffer allocated with malloc and store its length in *len. Exits if the
+// file cannot be read.
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *buf = (uint8_t *) malloc(*len + 1);
+    if (buf == NULL || fread(buf, 1, *len, file) != *len) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    return buf;
+}
+
+// Decompress every segment of the compressed file at path on its own and check that it holds as
+// many bytes as its header records, and that together they make up expected[0 .. expected_len).
+static bool check_segments(const char *path, const uint8_t *expected, size_t expected_len) {
+    size_t in_len;
+    uint8_t *in = read_file(path, &in_len);
+    int fd = open(path, O_RDONLY);
+    uint64_t *offsets = NULL;
+    uint32_t count = 0;
+    uint64_t end = 0;
+    if (fd < 0 || read_index(fd, &offsets, &count, &end) == false) {
+        fprintf(stderr, "%s: not a compressed file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    uint8_t *out = (uint8_t *) malloc(expected_len + 1);
+    bool valid = out != NULL;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count && valid; i++) {
+        uint64_t start = offsets[i];
+        uint64_t stop = i + 1 < count ? offsets[i + 1] : end;
+        FileHeader header;
+        memcpy(&header, in + start, sizeof(FileHeader));
+        if (big_endian()) {
+            header.size = swap64(header.size);
+        }
+
+        uint64_t written = 0;
+        int status = decompress_buffer(
+            in + start, stop - start, out, expected_len - total, &written);
+        if (status != DECOMPRESS_OK || written != header.size
+            || memcmp(out, expected + total, written) != 0) {
+            fprintf(stderr,
+                "%s: segment %" PRIu32 " decompresses to %" PRIu64 " bytes (status %d), header says "
+                "%" PRIu64 "\n",
+                path, i, written, status, header.size);
+            valid = false;
+        }
+        total += written;
+    }
+    if (valid && total != expected_len) {
+        fprintf(stderr, "%s: %" PRIu64 " bytes in %" PRIu32 " segments, expected %zu\n", path,
+            total, count, expected_len);
+        valid = false;
+    }
+    if (valid) {
+        printf("%s: %" PRIu32 " segments, sizes match\n", path, count);
+    }
+
+    free(out);
+    free(offsets);
+    free(in);
+    return valid;
+}
+
+// Check decompressed_size and decompress_buffer on the whole compressed file at path, which must
+// give back expected[0 .. expected_len), and check that a buffer one byte short overflows and an
+// input cut off inside its last segment is corrupt.
+static bool check_buffer(const char *path, const uint8_t *expected, size_t expected_len) {
+    size_t in_len;
+    uint8_t *in = read_file(path, &in_len);
+    uint8_t *out = (uint8_t *) malloc(expected_len + 1);
+    if (out == NULL) {
+        fprintf(stderr, "Failed to allocate output buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    int fd = open(path, O_RDONLY);
+    uint64_t *offsets = NULL;
+    uint32_t count = 0;
+    uint64_t end = 0;
+    if (fd < 0 || read_index(fd, &offsets, &count, &end) == false) {
+        fprintf(stderr, "%s: not a compressed file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    free(offsets);
+
+    bool valid = true;
+    uint64_t size = 0;
+    int status = decompressed_size(in, in_len, &size);
+    if (status != DECOMPRESS_OK || size != expected_len) {
+        fprintf(stderr, "%s: decompressed_size gives %" PRIu64 " (status %d), expected %zu\n",
+            path, size, status, expected_len);
+        valid = false;
+    }
+
+    uint64_t written = 0;
+    status = decompress_buffer(in, in_len, out, expected_len, &written);
+    if (status != DECOMPRESS_OK || written != expected_len
+        || memcmp(out, expected, expected_len) != 0) {
+        fprintf(stderr, "%s: decompress_buffer gives %" PRIu64 " bytes (status %d), expected %zu\n",
+            path, written, status, expected_len);
+        valid = false;
+    }
+
+    if (expected_len > 0) {
+        status = decompress_buffer(in, in_len, out, expected_len - 1, &written);
+        if (status != DECOMPRESS_OVERFLOW) {
+            fprintf(stderr, "%s: short buffer gives status %d, expected %d\n", path, status,
+                DECOMPRESS_OVERFLOW);
+            valid = false;
+        }
+    }
+
+    status = decompress_buffer(in, end - 1, out, expected_len, &written);
+    if (status != DECOMPRESS_CORRUPT) {
+        fprintf(stderr, "%s: truncated input gives status %d, expected %d\n", path, status,
+            DECOMPRESS_CORRUPT);
+        valid = false;
+    }
+    if (valid) {
+        printf("%s: %zu bytes, buffer checks pass\n", path, expected_len);
+    }
+
+    free(out);
+    free(in);
+    return valid;
+}
+
+// Usage: lzcheck compressed expected
+//
+// Checks a file written by encode against the file it was compressed from.
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s compressed expected\n", argv[0]);
+        return 1;
+    }
+    size_t expected_len;
+    uint8_t *expected = read_file(argv[2], &expected_len);
+    bool valid = check_segments(argv[1], expected, expected_len);
+    valid = check_buffer(argv[1], expected, expected_len) && valid;
+    free(expected);
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "trie.h"
+#include "word.h"
+#include "io.h"
+#include "code.h"
+#include "stream.h"
+
+static int bit_length(uint16_t n) {
+    int length = 0;
+    while (n > 0) {
+        length++;
+        n >>= 1;
+    }
+    return length;
+}
+
+// Write the header of a new segment at the current offset of outfile and record where it starts.
+// The offsets array grows by doubling, so this rarely allocates.
+static void begin_segment(int outfile, const FileHeader *header, SegmentTable *table) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity == 0 ? 1 : 2 * table->capacity;
+        table->offsets = (uint64_t *) realloc(table->offsets, table->capacity * sizeof(uint64_t));
+        if (table->offsets == NULL) {
+            fprintf(stderr, "Failed to allocate segment table\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    table->offsets[table->count++] = lseek(outfile, 0, SEEK_CUR);
+
+    FileHeader copy = *header;
+    write_header(outfile, &copy);
+}
+
+// Fill in the uncompressed size of the segment whose header is at offset, once its pairs have
+// been flushed, and return to the end of the output.
+static void end_segment(int outfile, const FileHeader *header, uint64_t offset, uint64_t size) {
+    off_t end = lseek(outfile, 0, SEEK_CUR);
+    FileHeader copy = *header;
+    copy.size = size;
+    lseek(outfile, offset, SEEK_SET);
+    write_header(outfile, &copy);
+    lseek(outfile, end, SEEK_SET);
+}
+
+// Return the number of bytes left to read from infile if it is a regular file, or SIZE_UNKNOWN if
+// that is not known in advance.
+static uint64_t input_size(int infile) {
+    struct stat stats;
+    off_t offset = lseek(infile, 0, SEEK_CUR);
+    if (fstat(infile, &stats) != 0 || !S_ISREG(stats.st_mode) || offset < 0
+        || offset > stats.st_size) {
+        return SIZE_UNKNOWN;
+    }
+    return stats.st_size - offset;
+}
+
+bool compress_segments(int infile, int outfile, const FileHeader *header, uint64_t memory,
+    SegmentTable *table, uint64_t *read) {
+    *read = 0;
+
+    // Segment sizes are filled in afterwards if the output is seekable. Otherwise the only size
+    // known is that of an input file, and only an uncapped dictionary keeps it in one segment.
+    bool seekable = lseek(outfile, 0, SEEK_CUR) != -1;
+    FileHeader segment_header = *header;
+    segment_header.size = !seekable && memory == 0 ? input_size(infile) : SIZE_UNKNOWN;
+
+    // With a memory cap every trie node comes from an arena allocated here, never in the loop
+    TrieArena *arena = NULL;
+    TrieNode *root = NULL;
+    if (memory > 0) {
+        arena = trie_arena_create(memory);
+        if (arena == NULL) {
+            fprintf(stderr, "Failed to allocate a %" PRIu64 " byte dictionary\n", memory);
+            return false;
+        }
+        root = trie_arena_root(arena);
+    } else {
+        root = trie_create();
+    }
+    TrieNode *curr_node = root;
+    TrieNode *prev_node = NULL;
+    uint8_t curr_sym = 0;
+    uint8_t prev_sym = 0;
+    uint16_t next_code = START_CODE;
+
+    uint64_t segment_syms = 0;
+    begin_segment(outfile, &segment_header, table);
+
+    // Symbols are counted as soon as they are read, so one whose pair ends a segment is counted in
+    // that segment and not the next
+    while (read_sym(infile, &curr_sym) == true) {
+        (*read)++;
+        segment_syms++;
+        TrieNode *next_node = trie_step(curr_node, curr_sym);
+        if (next_node != NULL) {
+            prev_node = curr_node;
+            curr_node = next_node;
+        } else {
+            write_pair(outfile, curr_node->code, curr_sym, bit_length(next_code));
+            TrieNode *node = arena != NULL ? trie_arena_node(arena, next_code)
+                                           : trie_node_create(next_code);
+            curr_node->children[curr_sym] = node;
+            curr_node = root;
+            next_code++;
+            if (node == NULL && arena == NULL) {
+                fprintf(stderr, "Failed to allocate trie node\n");
+                trie_delete(root);
+                return false;
+            }
+            if (node == NULL) {
+                // Arena is full: end this segment so decode starts a fresh dictionary with us
+                write_pair(outfile, STOP_CODE, 0, bit_length(next_code));
+                flush_pairs(outfile);
+                if (seekable) {
+                    end_segment(
+                        outfile, &segment_header, table->offsets[table->count - 1], segment_syms);
+                }
+                begin_segment(outfile, &segment_header, table);
+                segment_syms = 0;
+                trie_arena_reset(arena);
+                next_code = START_CODE;
+            }
+        }
+        if (next_code == MAX_CODE) {
+            if (arena != NULL) {
+                trie_arena_reset(arena);
+            } else {
+                trie_reset(root);
+            }
+            curr_node = root;
+            next_code = START_CODE;
+        }
+        prev_sym = curr_sym;
+    }
+    if (curr_node != root) {
+        write_pair(outfile, prev_node->code, prev_sym, bit_length(next_code));
+        next_code++;
+        next_code %= MAX_CODE;
+    }
+    write_pair(outfile, STOP_CODE, 0, bit_length(next_code));
+    flush_pairs(outfile);
+    if (seekable) {
+        end_segment(outfile, &segment_header, table->offsets[table->count - 1], segment_syms);
+    }
+
+    if (arena != NULL) {
+        trie_arena_delete(arena);
+    } else {
+        trie_delete(root);
+    }
+    return true;
+}
+
+bool compress_stream(int infile, int outfile, uint16_t protection, uint64_t *read) {
+    FileHeader file_header;
+    file_header.magic = MAGIC;
+    file_header.protection = protection;
+    file_header.reserved = 0;
+    file_header.size = SIZE_UNKNOWN;
+
+    SegmentTable table = { NULL, 0, 0 };
+    bool valid = compress_segments(infile, outfile, &file_header, 0, &table, read);
+    free(table.offsets);
+    return valid;
+}
+
+bool decompress_stream(int infile, int outfile, uint64_t *written) {
+    *written = 0;
+    FileHeader file_header;
+    if (read_segment(infile, &file_header) == false) {
+        return false;
+    }
+
+    WordTable *table = wt_create();
+    uint8_t curr_sym = 0;
+    uint16_t curr_code = 0;
+    uint16_t next_code = START_CODE;
+
+    // Segments appended by encode -a each start with a fresh dictionary
+    do {
+        while (read_pair(infile, &curr_code, &curr_sym, bit_length(next_code)) == true) {
+            table[next_code] = word_append_sym(table[curr_code], curr_sym);
+            write_word(outfile, table[next_code]);
+            *written += table[next_code]->len;
+            next_code++;
+            if ((next_code == MAX_CODE) == true) {
+                wt_reset(table);
+                next_code = START_CODE;
+            }
+        }
+        wt_reset(table);
+        next_code = START_CODE;
+    } while (read_segment(infile, &file_header) == true);
+    flush_words(outfile);
+    wt_delete(table);
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "io.h"
+
+//
+// Byte offsets of the segments of a compressed file. offsets holds capacity entries (allocated
+// with malloc, freed by the owner of the table) of which the first count are in use.
+//
+typedef struct SegmentTable {
+    uint64_t *offsets;
+    uint32_t count;
+    uint32_t capacity;
+} SegmentTable;
+
+//
+// Compress everything read from infile into outfile, from its current offset on, as one or more
+// segments that each start with a copy of *header. Append the offset of every segment to table
+// and store the number of bytes read from infile in *read.
+//
+// If memory is 0 the dictionary grows one node at a time and everything is a single segment.
+// Otherwise it is capped at memory bytes, allocated once, and a new segment with a fresh dictionary
+// starts whenever it is full.
+//
+// If outfile is seekable the uncompressed size of each segment is filled in once it ends.
+// Otherwise the size is that of infile when it is a regular file and everything is one segment,
+// and SIZE_UNKNOWN when it is not known. No segment table is written; that is up to the caller.
+//
+// Return false and print an error if the dictionary cannot be allocated.
+//
+bool compress_segments(int infile, int outfile, const FileHeader *header, uint64_t memory,
+    SegmentTable *table, uint64_t *read);
+
+//
+// Compress everything read from infile into outfile as encode does, with an unbounded dictionary:
+// a single segment whose header records protection and the uncompressed size if it is known (see
+// compress_segments), and no segment table. Store the number of bytes read from infile in *read.
+// Return false if the dictionary cannot be allocated.
+//
+// Neither descriptor needs to be seekable, so this can be one stage of a pipeline. It uses the
+// global buffers of io.c, so only one thread may compress or decompress at a time.
+//
+bool compress_stream(int infile, int outfile, uint16_t protection, uint64_t *read);
+
+//
+// Decompress every segment read from infile into outfile and store the number of bytes written in
+// *written. Return false if infile does not start with a file header.
+//
+// Like compress_stream this never seeks and uses the global buffers of io.c.
+//
+bool decompress_stream(int infile, int outfile, uint64_t *written);
+
+#endif
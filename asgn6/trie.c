@@ -20,8 +20,17 @@
 #include "code.h"
 #include "endian.h"
 
+struct TrieArena {
+    TrieNode *nodes;
+    uint32_t capacity;
+    uint32_t used;
+};
+
 TrieNode *trie_node_create(uint16_t index) {
     TrieNode *node = (TrieNode *) malloc(sizeof(TrieNode));
+    if (node == NULL) {
+        return NULL;
+    }
     node->code = index;
     for (int i = 0; i < ALPHABET; i++) {
         node->children[i] = NULL;
@@ -71,3 +80,56 @@ void trie_delete(TrieNode *n) {
 TrieNode *trie_step(TrieNode *n, uint8_t sym) {
     return n->children[sym];
 }
+
+TrieArena *trie_arena_create(uint64_t bytes) {
+    uint64_t capacity = bytes / sizeof(TrieNode);
+    if (capacity > MAX_CODE) {
+        capacity = MAX_CODE;
+    }
+    if (capacity < 2) {
+        return NULL;
+    }
+
+    TrieArena *a = (TrieArena *) malloc(sizeof(TrieArena));
+    if (a == NULL) {
+        return NULL;
+    }
+    // Touch every node now so the footprint is paid at startup, not in the encode loop
+    a->nodes = (TrieNode *) malloc(capacity * sizeof(TrieNode));
+    if (a->nodes == NULL) {
+        free(a);
+        return NULL;
+    }
+    memset(a->nodes, 0, capacity * sizeof(TrieNode));
+    a->capacity = capacity;
+    a->nodes[0].code = EMPTY_CODE;
+    a->used = 1;
+    return a;
+}
+
+TrieNode *trie_arena_root(TrieArena *a) {
+    return &a->nodes[0];
+}
+
+TrieNode *trie_arena_node(TrieArena *a, uint16_t code) {
+    if (a->used == a->capacity) {
+        return NULL;
+    }
+    TrieNode *node = &a->nodes[a->used++];
+    memset(node->children, 0, sizeof(node->children));
+    node->code = code;
+    return node;
+}
+
+void trie_arena_reset(TrieArena *a) {
+    memset(a->nodes[0].children, 0, sizeof(a->nodes[0].children));
+    a->used = 1;
+}
+
+void trie_arena_delete(TrieArena *a) {
+    if (a == NULL) {
+        return;
+    }
+    free(a->nodes);
+    free(a);
+}
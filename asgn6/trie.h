@@ -7,6 +7,8 @@
 
 typedef struct TrieNode TrieNode;
 
+typedef struct TrieArena TrieArena;
+
 struct TrieNode {
     TrieNode *children[ALPHABET];
     uint16_t code;
@@ -53,4 +55,36 @@ void trie_delete(TrieNode *n);
  */
 TrieNode *trie_step(TrieNode *n, uint8_t sym);
 
+/*
+ * Constructor: Creates an arena holding as many TrieNodes as fit in bytes
+ * (at most one per code) and allocates all of them up front
+ * The first node of the arena is the root, with code EMPTY_CODE
+ * Returns NULL if bytes is too small for a root and a child or the allocation fails
+ */
+TrieArena *trie_arena_create(uint64_t bytes);
+
+/*
+ * Returns the root node of arena a
+ */
+TrieNode *trie_arena_root(TrieArena *a);
+
+/*
+ * Hands out the next unused node of arena a with the given code
+ * Never allocates memory
+ * Returns NULL once every node of the arena is in use
+ */
+TrieNode *trie_arena_node(TrieArena *a, uint16_t code);
+
+/*
+ * Resets the trie held in arena a: clears the children of the root
+ * and returns every other node to the arena at once
+ */
+void trie_arena_reset(TrieArena *a);
+
+/*
+ * Destructor: Frees the arena and every node in it
+ * Nodes from an arena must not be passed to trie_delete or trie_node_delete
+ */
+void trie_arena_delete(TrieArena *a);
+
 #endif